@@ -15,9 +15,264 @@ var QWebChannelMessageTypes = {
     disconnectFromSignal: 8,
     setProperty: 9,
     response: 10,
+    objectInfo: 11,
+    observeProperties: 12,
 };
 
-var QWebChannel = function(transport, initCallback, converters)
+// NOTE: keep in sync with the capabilities in qmetaobjectpublisher.cpp
+var QWebChannelCapabilities = [
+    "cbor",
+    "compactUpdates",
+    "typeDescriptors",
+    "lazyInit",
+    "propertyInterest",
+    "credits",
+    "handles",
+    "packedArrays",
+];
+
+// Decodes a CBOR encoded message, as sent by the server when the "cbor" option is used.
+function decodeCbor(buffer)
+{
+    var bytes = buffer instanceof ArrayBuffer
+        ? new Uint8Array(buffer)
+        : new Uint8Array(buffer.buffer, buffer.byteOffset, buffer.byteLength);
+    var view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    var offset = 0;
+
+    function readArgument(info)
+    {
+        var value;
+        if (info < 24)
+            return info;
+        switch (info) {
+            case 24:
+                value = view.getUint8(offset);
+                offset += 1;
+                return value;
+            case 25:
+                value = view.getUint16(offset);
+                offset += 2;
+                return value;
+            case 26:
+                value = view.getUint32(offset);
+                offset += 4;
+                return value;
+            case 27:
+                value = view.getUint32(offset) * 4294967296 + view.getUint32(offset + 4);
+                offset += 8;
+                return value;
+            case 31:
+                return -1; // indefinite length
+        }
+        throw new Error("Invalid CBOR argument encoding: " + info);
+    }
+
+    function isBreak()
+    {
+        if (view.getUint8(offset) !== 0xff)
+            return false;
+        ++offset;
+        return true;
+    }
+
+    function readHalfFloat()
+    {
+        var half = view.getUint16(offset);
+        offset += 2;
+        var exponent = (half >> 10) & 0x1f;
+        var mantissa = half & 0x3ff;
+        var value;
+        if (exponent === 0)
+            value = mantissa * Math.pow(2, -24);
+        else if (exponent !== 31)
+            value = (mantissa + 1024) * Math.pow(2, exponent - 25);
+        else
+            value = mantissa ? NaN : Infinity;
+        return (half & 0x8000) ? -value : value;
+    }
+
+    function readString(length)
+    {
+        var end = offset + length;
+        var units = [];
+        var result = "";
+        while (offset < end) {
+            var byte = bytes[offset++];
+            var codePoint;
+            if (byte < 0x80) {
+                codePoint = byte;
+            } else if (byte < 0xe0) {
+                codePoint = ((byte & 0x1f) << 6) | (bytes[offset++] & 0x3f);
+            } else if (byte < 0xf0) {
+                codePoint = ((byte & 0x0f) << 12) | ((bytes[offset++] & 0x3f) << 6)
+                          | (bytes[offset++] & 0x3f);
+            } else {
+                codePoint = ((byte & 0x07) << 18) | ((bytes[offset++] & 0x3f) << 12)
+                          | ((bytes[offset++] & 0x3f) << 6) | (bytes[offset++] & 0x3f);
+            }
+            if (codePoint > 0xffff) {
+                codePoint -= 0x10000;
+                units.push(0xd800 | (codePoint >> 10), 0xdc00 | (codePoint & 0x3ff));
+            } else {
+                units.push(codePoint);
+            }
+            if (units.length >= 4096) {
+                result += String.fromCharCode.apply(null, units);
+                units = [];
+            }
+        }
+        return result + String.fromCharCode.apply(null, units);
+    }
+
+    function readChunks(majorType, info, readChunk)
+    {
+        var length = readArgument(info);
+        if (length >= 0)
+            return [readChunk(length)];
+        var chunks = [];
+        while (!isBreak()) {
+            var initial = view.getUint8(offset++);
+            if ((initial >> 5) !== majorType)
+                throw new Error("Invalid chunk in indefinite length CBOR string");
+            chunks.push(readChunk(readArgument(initial & 0x1f)));
+        }
+        return chunks;
+    }
+
+    function readItem()
+    {
+        var initial = view.getUint8(offset++);
+        var majorType = initial >> 5;
+        var info = initial & 0x1f;
+        var length, result, i;
+        switch (majorType) {
+            case 0:
+                return readArgument(info);
+            case 1:
+                return -1 - readArgument(info);
+            case 2: {
+                var chunks = readChunks(majorType, info, function(length) {
+                    offset += length;
+                    return bytes.subarray(offset - length, offset);
+                });
+                length = chunks.reduce(function(sum, chunk) { return sum + chunk.length; }, 0);
+                result = new Uint8Array(length);
+                length = 0;
+                for (const chunk of chunks) {
+                    result.set(chunk, length);
+                    length += chunk.length;
+                }
+                return result;
+            }
+            case 3:
+                return readChunks(majorType, info, readString).join("");
+            case 4:
+                length = readArgument(info);
+                result = [];
+                for (i = 0; length < 0 ? !isBreak() : i < length; ++i)
+                    result.push(readItem());
+                return result;
+            case 5:
+                length = readArgument(info);
+                result = {};
+                for (i = 0; length < 0 ? !isBreak() : i < length; ++i) {
+                    var key = readItem();
+                    result[key] = readItem();
+                }
+                return result;
+            case 6:
+                // tags carry no extra meaning for the messages, only decode the tagged item
+                readArgument(info);
+                return readItem();
+            case 7:
+                switch (info) {
+                    case 20:
+                        return false;
+                    case 21:
+                        return true;
+                    case 22:
+                        return null;
+                    case 23:
+                        return undefined;
+                    case 25:
+                        return readHalfFloat();
+                    case 26:
+                        result = view.getFloat32(offset);
+                        offset += 4;
+                        return result;
+                    case 27:
+                        result = view.getFloat64(offset);
+                        offset += 8;
+                        return result;
+                }
+                if (info < 24)
+                    return undefined; // unassigned simple value
+                if (info === 24) {
+                    ++offset;
+                    return undefined;
+                }
+                break;
+        }
+        throw new Error("Invalid CBOR item: " + initial);
+    }
+
+    return readItem();
+}
+
+// The typed arrays of the packed lists of numbers, as sent by the server when the "packedArrays"
+// option is used.
+var QWebChannelPackedArrayTypes = {
+    f32: Float32Array,
+    f64: Float64Array,
+    i32: Int32Array,
+};
+
+var base64Values = new Uint8Array(128);
+"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/".split("").forEach(
+    function(character, value) { base64Values[character.charCodeAt(0)] = value; });
+
+// Decodes a packed list of numbers, which is a base64 encoded buffer of little endian elements.
+function decodePackedArray(packed)
+{
+    var type = QWebChannelPackedArrayTypes[packed.__packed__];
+    var text = packed.data;
+    var length = text.length;
+    while (length > 0 && text.charAt(length - 1) === "=")
+        --length;
+    var bytes = new Uint8Array(Math.floor(length * 3 / 4));
+    var byteIndex = 0;
+    var bits = 0;
+    var buffer = 0;
+    for (var i = 0; i < length; ++i) {
+        buffer = (buffer << 6) | base64Values[text.charCodeAt(i)];
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes[byteIndex++] = (buffer >> bits) & 0xff;
+            buffer &= (1 << bits) - 1;
+        }
+    }
+
+    var count = bytes.length / type.BYTES_PER_ELEMENT;
+    if (new Uint8Array(new Uint16Array([1]).buffer)[0] === 1)
+        return new type(bytes.buffer, 0, count);
+    // big endian platforms have to swap the bytes of the elements
+    var view = new DataView(bytes.buffer);
+    var array = new type(count);
+    for (var j = 0; j < count; ++j) {
+        var offset = j * type.BYTES_PER_ELEMENT;
+        if (type === Float32Array)
+            array[j] = view.getFloat32(offset, true);
+        else if (type === Float64Array)
+            array[j] = view.getFloat64(offset, true);
+        else
+            array[j] = view.getInt32(offset, true);
+    }
+    return array;
+}
+
+var QWebChannel = function(transport, initCallback, converters, options)
 {
     if (typeof transport !== "object" || typeof transport.send !== "function") {
         console.error("The QWebChannel expects a transport object with a send function and onmessage callback property." +
@@ -78,6 +333,8 @@ var QWebChannel = function(transport, initCallback, converters)
         var data = message.data;
         if (typeof data === "string") {
             data = JSON.parse(data);
+        } else if (data instanceof ArrayBuffer || ArrayBuffer.isView(data)) {
+            data = decodeCbor(data);
         }
         switch (data.type) {
             case QWebChannelMessageTypes.signal:
@@ -118,13 +375,30 @@ var QWebChannel = function(transport, initCallback, converters)
     };
 
     this.objects = {};
+    this.types = {};
+    // objects by their handle, see the handles option
+    this.handles = {};
+
+    // Returns the object the server addresses by its id or, with the handles option, its handle
+    function addressedObject(address)
+    {
+        return typeof address === "number" ? channel.handles[address] : channel.objects[address];
+    }
+
+    // Returns true if the addressed object might be one that was not loaded yet
+    function isUnloaded(address)
+    {
+        if (typeof address === "number")
+            return Object.keys(channel.unloadedObjects).length > 0;
+        return !!channel.unloadedObjects[address];
+    }
 
     this.handleSignal = function(message)
     {
-        var object = channel.objects[message.object];
+        var object = addressedObject(message.object);
         if (object) {
             object.signalEmitted(message.signal, message.args);
-        } else {
+        } else if (!isUnloaded(message.object)) {
             console.warn("Unhandled signal: " + message.object + "::" + message.signal);
         }
     }
@@ -135,31 +409,144 @@ var QWebChannel = function(transport, initCallback, converters)
             console.error("Invalid response message received: ", JSON.stringify(message));
             return;
         }
-        channel.execCallbacks[message.id](message.data);
+        // type descriptors, see the typeDescriptors option, arrive before the objects using them
+        if (message.types)
+            Object.assign(channel.types, message.types);
+        channel.execCallbacks[message.id](message.data, message);
         delete channel.execCallbacks[message.id];
     }
 
     this.handlePropertyUpdate = function(message)
     {
         message.data.forEach(data => {
-            var object = channel.objects[data.object];
+            var object = addressedObject(data.object);
             if (object) {
                 object.propertyUpdate(data.signals, data.properties);
-            } else {
+            } else if (!isUnloaded(data.object)) {
                 console.warn("Unhandled property update: " + data.object + "::" + data.signal);
             }
         });
-        channel.exec({type: QWebChannelMessageTypes.idle});
+        channel.acknowledgeUpdates(1);
+    }
+
+    // Tells the server that the client is ready for more property updates. With the credits
+    // option, this grants the server to send the given number of further updates.
+    this.acknowledgeUpdates = function(credits)
+    {
+        if (channel.capabilities.credits)
+            channel.exec({type: QWebChannelMessageTypes.idle, credits: credits});
+        else
+            channel.exec({type: QWebChannelMessageTypes.idle});
     }
 
+    // ids of the registered objects that were not loaded yet, see the lazyInit option
+    this.unloadedObjects = {};
+    var pendingLoads = {};
+
+    // Calls callback with the registered object of the given name once its class information
+    // was received. Without a callback, a Promise is returned instead.
+    this.loadObject = function(name, callback)
+    {
+        if (!callback && typeof Promise === "function") {
+            return new Promise(function(resolve) {
+                channel.loadObject(name, resolve);
+            });
+        }
+        callback = callback || function() {};
+
+        if (channel.objects[name]) {
+            callback(channel.objects[name]);
+            return;
+        }
+        if (!channel.unloadedObjects[name]) {
+            console.error("Cannot load unknown object " + name + ".");
+            return;
+        }
+        if (pendingLoads[name]) {
+            pendingLoads[name].push(callback);
+            return;
+        }
+        pendingLoads[name] = [callback];
+
+        channel.exec({type: QWebChannelMessageTypes.objectInfo, object: name}, function(data) {
+            delete channel.unloadedObjects[name];
+            var object = new QObject(name, data, channel);
+
+            // load the registered objects referenced by properties before unwrapping them
+            var references = [];
+            var collectReferences = function(value) {
+                if (!(value instanceof Object))
+                    return;
+                if (value["__QObject*__"] && value.id !== undefined) {
+                    if (channel.unloadedObjects[value.id] && references.indexOf(value.id) === -1)
+                        references.push(value.id);
+                    return;
+                }
+                for (const key of Object.keys(value))
+                    collectReferences(value[key]);
+            };
+            collectReferences(object.__propertyCache__);
+
+            var remaining = references.length + 1;
+            var referenceLoaded = function() {
+                if (--remaining > 0)
+                    return;
+                object.unwrapProperties();
+                var callbacks = pendingLoads[name];
+                delete pendingLoads[name];
+                callbacks.forEach(function(callback) { callback(object); });
+            };
+            references.forEach(function(reference) { channel.loadObject(reference, referenceLoaded); });
+            referenceLoaded();
+        });
+    };
+
+    // Starts receiving updates of the given properties of object, see the propertyInterest option
+    this.observeProperties = function(object, propertyNames)
+    {
+        object.observeProperties(propertyNames.map(name => object.__propertyIndexes__[name]), true);
+    };
+
+    // Stops receiving updates of the given properties of object, see the propertyInterest option
+    this.unobserveProperties = function(object, propertyNames)
+    {
+        object.observeProperties(propertyNames.map(name => object.__propertyIndexes__[name]), false);
+    };
+
     this.debug = function(message)
     {
         channel.send({type: QWebChannelMessageTypes.debug, data: message});
     };
 
-    channel.exec({type: QWebChannelMessageTypes.init}, function(data) {
-        for (const objectName of Object.keys(data)) {
-            new QObject(objectName, data[objectName], channel);
+    // the capabilities which the server accepted, see the options argument
+    this.capabilities = {};
+
+    var initMessage = {type: QWebChannelMessageTypes.init};
+    if (options) {
+        var requestedCapabilities = {};
+        for (const capability of QWebChannelCapabilities) {
+            if (options[capability])
+                requestedCapabilities[capability] = options[capability];
+        }
+        if (Object.keys(requestedCapabilities).length > 0)
+            initMessage.capabilities = requestedCapabilities;
+        // binary messages must be received as ArrayBuffer for decodeCbor
+        if (requestedCapabilities.cbor && "binaryType" in transport)
+            transport.binaryType = "arraybuffer";
+    }
+
+    channel.exec(initMessage, function(data, response) {
+        if (response && response.capabilities)
+            channel.capabilities = response.capabilities;
+
+        if (Array.isArray(data)) {
+            // lazy init, the objects are created by loadObject
+            for (const objectName of data)
+                channel.unloadedObjects[objectName] = true;
+        } else {
+            for (const objectName of Object.keys(data)) {
+                new QObject(objectName, data[objectName], channel);
+            }
         }
 
         // now unwrap properties, which might reference other registered objects
@@ -170,7 +557,7 @@ var QWebChannel = function(transport, initCallback, converters)
         if (initCallback) {
             initCallback(channel);
         }
-        channel.exec({type: QWebChannelMessageTypes.idle});
+        channel.acknowledgeUpdates(channel.capabilities.credits);
     });
 };
 
@@ -179,12 +566,25 @@ function QObject(name, data, webChannel)
     this.__id__ = name;
     webChannel.objects[name] = this;
 
+    // With the handles option, the server addresses the object by its handle, which is then
+    // also used in the messages to the server
+    this.__handle__ = data.handle;
+    this.__address__ = data.handle !== undefined ? data.handle : name;
+    if (data.handle !== undefined)
+        webChannel.handles[data.handle] = this;
+
     // List of callbacks that get invoked upon signal emission
     this.__objectSignals__ = {};
 
     // Cache of all properties, updated when a notify signal is emitted
     this.__propertyCache__ = {};
 
+    // Maps property names to their indexes
+    this.__propertyIndexes__ = {};
+
+    // Indexes of the properties the server sends updates for, see the propertyInterest option
+    this.__observedProperties__ = {};
+
     var object = this;
 
     // ----------------------------------------------------------------------
@@ -204,6 +604,9 @@ function QObject(name, data, webChannel)
         if (!(response instanceof Object))
             return response;
 
+        if (response.__packed__ !== undefined && QWebChannelPackedArrayTypes[response.__packed__])
+            return decodePackedArray(response);
+
         if (!response["__QObject*__"] || response.id === undefined) {
             var jObj = {};
             for (const propName of Object.keys(response)) {
@@ -216,6 +619,10 @@ function QObject(name, data, webChannel)
         if (webChannel.objects[objectId])
             return webChannel.objects[objectId];
 
+        if (!response.data && webChannel.unloadedObjects[objectId]) {
+            console.warn("Cannot unwrap QObject " + objectId + " before it was loaded with loadObject().");
+            return;
+        }
         if (!response.data) {
             console.error("Cannot unwrap unknown QObject " + objectId + " without data.");
             return;
@@ -225,6 +632,8 @@ function QObject(name, data, webChannel)
         qObject.destroyed.connect(function() {
             if (webChannel.objects[objectId] === qObject) {
                 delete webChannel.objects[objectId];
+                if (qObject.__handle__ !== undefined)
+                    delete webChannel.handles[qObject.__handle__];
                 // reset the now deleted QObject to an empty {} object
                 // just assigning {} though would not have the desired effect, but the
                 // below also ensures all external references will see the empty map
@@ -244,6 +653,37 @@ function QObject(name, data, webChannel)
         }
     }
 
+    // Maps the indexes of notify signals to the indexes of the properties they notify
+    var notifiedProperties = {};
+
+    // Declares interest in the properties of the given indexes, or the lack thereof
+    this.observeProperties = function(propertyIndexes, observe)
+    {
+        if (!webChannel.capabilities.propertyInterest)
+            return;
+        var changed = propertyIndexes.filter(function(propertyIndex) {
+            if (propertyIndex === undefined)
+                return false;
+            return Boolean(object.__observedProperties__[propertyIndex]) !== observe;
+        });
+        if (changed.length === 0)
+            return;
+        changed.forEach(function(propertyIndex) {
+            if (observe)
+                object.__observedProperties__[propertyIndex] = true;
+            else
+                delete object.__observedProperties__[propertyIndex];
+        });
+        var message = {
+            type: QWebChannelMessageTypes.observeProperties,
+            object: object.__address__,
+            properties: changed
+        };
+        if (!observe)
+            message.observe = false;
+        webChannel.exec(message);
+    }
+
     function addSignal(signalData, isPropertyNotifySignal)
     {
         var signalName = signalData[0];
@@ -259,8 +699,10 @@ function QObject(name, data, webChannel)
                 object.__objectSignals__[signalIndex].push(callback);
 
                 // only required for "pure" signals, handled separately for properties in propertyUpdate
-                if (isPropertyNotifySignal)
+                if (isPropertyNotifySignal) {
+                    object.observeProperties(notifiedProperties[signalIndex], true);
                     return;
+                }
 
                 // also note that we always get notified about the destroyed signal
                 if (signalName === "destroyed" || signalName === "destroyed()" || signalName === "destroyed(QObject*)")
@@ -270,7 +712,7 @@ function QObject(name, data, webChannel)
                 if (object.__objectSignals__[signalIndex].length == 1) {
                     webChannel.exec({
                         type: QWebChannelMessageTypes.connectToSignal,
-                        object: object.__id__,
+                        object: object.__address__,
                         signal: signalIndex
                     });
                 }
@@ -289,7 +731,7 @@ function QObject(name, data, webChannel)
                     // only required for "pure" signals, handled separately for properties in propertyUpdate
                     webChannel.exec({
                         type: QWebChannelMessageTypes.disconnectFromSignal,
-                        object: object.__id__,
+                        object: object.__address__,
                         signal: signalIndex
                     });
                 }
@@ -312,16 +754,26 @@ function QObject(name, data, webChannel)
 
     this.propertyUpdate = function(signals, propertyMap)
     {
-        // update property cache
-        for (const propertyIndex of Object.keys(propertyMap)) {
-            var propertyValue = propertyMap[propertyIndex];
-            object.__propertyCache__[propertyIndex] = this.unwrapQObject(propertyValue);
+        var i;
+        // update property cache, the compactUpdates format is a flat [index, value, ...] array
+        if (Array.isArray(propertyMap)) {
+            for (i = 0; i < propertyMap.length; i += 2)
+                object.__propertyCache__[propertyMap[i]] = this.unwrapQObject(propertyMap[i + 1]);
+        } else {
+            for (const propertyIndex of Object.keys(propertyMap)) {
+                var propertyValue = propertyMap[propertyIndex];
+                object.__propertyCache__[propertyIndex] = this.unwrapQObject(propertyValue);
+            }
         }
 
-        for (const signalName of Object.keys(signals)) {
-            // Invoke all callbacks, as signalEmitted() does not. This ensures the
-            // property cache is updated before the callbacks are invoked.
-            invokeSignalCallbacks(signalName, signals[signalName]);
+        // Invoke all callbacks, as signalEmitted() does not. This ensures the
+        // property cache is updated before the callbacks are invoked.
+        if (Array.isArray(signals)) {
+            for (i = 0; i < signals.length; i += 2)
+                invokeSignalCallbacks(signals[i], signals[i + 1]);
+        } else {
+            for (const signalName of Object.keys(signals))
+                invokeSignalCallbacks(signalName, signals[signalName]);
         }
     }
 
@@ -363,7 +815,7 @@ function QObject(name, data, webChannel)
 
             webChannel.exec({
                 "type": QWebChannelMessageTypes.invokeMethod,
-                "object": object.__id__,
+                "object": object.__address__,
                 "method": invokedMethod,
                 "args": args
             }, function(response) {
@@ -390,8 +842,11 @@ function QObject(name, data, webChannel)
         // NOTE: if this is an object, it is not directly unwrapped as it might
         // reference other QObject that we do not know yet
         object.__propertyCache__[propertyIndex] = propertyInfo[3];
+        object.__propertyIndexes__[propertyName] = propertyIndex;
 
         if (notifySignalData) {
+            notifiedProperties[notifySignalData[1]] = notifiedProperties[notifySignalData[1]] || [];
+            notifiedProperties[notifySignalData[1]].push(propertyIndex);
             if (notifySignalData[0] === 1) {
                 // signal name is optimized away, reconstruct the actual name
                 notifySignalData[0] = propertyName + "Changed";
@@ -402,6 +857,9 @@ function QObject(name, data, webChannel)
         Object.defineProperty(object, propertyName, {
             configurable: true,
             get: function () {
+                // with the propertyInterest option, updates are only received after the first read
+                if (!object.__observedProperties__[propertyIndex])
+                    object.observeProperties([propertyIndex], true);
                 var propertyValue = object.__propertyCache__[propertyIndex];
                 if (propertyValue === undefined) {
                     // This shouldn't happen
@@ -419,7 +877,7 @@ function QObject(name, data, webChannel)
                 var valueToSend = value;
                 webChannel.exec({
                     "type": QWebChannelMessageTypes.setProperty,
-                    "object": object.__id__,
+                    "object": object.__address__,
                     "property": propertyIndex,
                     "value": valueToSend
                 });
@@ -430,6 +888,22 @@ function QObject(name, data, webChannel)
 
     // ----------------------------------------------------------------------
 
+    if (data.type !== undefined) {
+        // the object references a type descriptor and only carries its property values
+        var type = webChannel.types[data.type];
+        if (!type) {
+            console.error("Cannot create QObject " + name + " of unknown type " + data.type + ".");
+            return;
+        }
+        var values = data.values;
+        data = {
+            methods: type.methods,
+            signals: type.signals,
+            enums: type.enums,
+            properties: type.properties.map((propertyInfo, i) => propertyInfo.concat([values[i]]))
+        };
+    }
+
     data.methods.forEach(addMethod);
 
     data.properties.forEach(bindGetterSetter);
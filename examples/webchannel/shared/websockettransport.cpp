@@ -29,6 +29,8 @@ WebSocketTransport::WebSocketTransport(QWebSocket *socket)
             this, &WebSocketTransport::textMessageReceived);
     connect(socket, &QWebSocket::disconnected,
             this, &WebSocketTransport::deleteLater);
+    // pre-serialized JSON and CBOR messages can be sent as-is
+    setSupportedMessageFormats(JsonFormat | CborFormat);
 }
 
 /*!
@@ -48,6 +50,19 @@ void WebSocketTransport::sendMessage(const QJsonObject &message)
     m_socket->sendTextMessage(QString::fromUtf8(doc.toJson(QJsonDocument::Compact)));
 }
 
+/*!
+    Send the already serialized message via the WebSocket to the client: JSON as a text message,
+    CBOR as a binary message.
+*/
+void WebSocketTransport::sendEncodedMessage(const QByteArray &message,
+                                            QWebChannelAbstractTransport::MessageFormat format)
+{
+    if (format == CborFormat)
+        m_socket->sendBinaryMessage(message);
+    else
+        m_socket->sendTextMessage(QString::fromUtf8(message));
+}
+
 /*!
     Deserialize the stringified JSON messageData and emit messageReceived.
 */
@@ -19,6 +19,10 @@ public:
 
     void sendMessage(const QJsonObject &message) override;
 
+public slots:
+    void sendEncodedMessage(const QByteArray &message,
+                            QWebChannelAbstractTransport::MessageFormat format);
+
 private slots:
     void textMessageReceived(const QString &message);
 
@@ -7,6 +7,7 @@
 #include "qwebchannel_p.h"
 #include "qwebchannelabstracttransport.h"
 
+#include <QCborStreamWriter>
 #include <QEvent>
 #if QT_CONFIG(future)
 #include <QFuture>
@@ -15,12 +16,20 @@
 #include <QDebug>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QtEndian>
+#include <QAssociativeIterable>
+#include <QSequentialIterable>
 #ifndef QT_NO_JSVALUE
 #include <QJSValue>
 #endif
 #include <QUuid>
 
 #include <QtCore/private/qmetaobject_p.h>
+#include <QtCore/private/qobject_p.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 QT_BEGIN_NAMESPACE
 
@@ -136,6 +145,105 @@ const QString KEY_METHOD = QStringLiteral("method");
 const QString KEY_ARGS = QStringLiteral("args");
 const QString KEY_PROPERTY = QStringLiteral("property");
 const QString KEY_VALUE = QStringLiteral("value");
+const QString KEY_CAPABILITIES = QStringLiteral("capabilities");
+const QString KEY_VALUES = QStringLiteral("values");
+const QString KEY_TYPES = QStringLiteral("types");
+const QString KEY_OBSERVE = QStringLiteral("observe");
+const QString KEY_CREDITS = QStringLiteral("credits");
+const QString KEY_HANDLE = QStringLiteral("handle");
+const QString KEY_PACKED = QStringLiteral("__packed__");
+
+// object handles keep the slot in the lower bits and the generation in the upper bits, which
+// stays below 2^53 so that handles are represented exactly by JavaScript numbers
+constexpr int HandleSlotBits = 24;
+constexpr qint64 HandleSlotMask = (qint64(1) << HandleSlotBits) - 1;
+constexpr quint32 HandleGenerationMask = (quint32(1) << 29) - 1;
+
+// upper bound for the credit window a client can negotiate, to limit the messages in flight
+constexpr int MaxCreditWindow = 64;
+
+// upper bound for the cached overload resolutions, as clients choose the argument kinds
+constexpr qsizetype MaxOverloadResolutions = 1024;
+
+struct CapabilityName
+{
+    ClientCapability capability;
+    QLatin1StringView name;
+};
+
+// NOTE: keep in sync with the capability names in qwebchannel.js
+constexpr CapabilityName capabilityNames[] = {
+    { CborCapability, QLatin1StringView("cbor") },
+    { CompactUpdatesCapability, QLatin1StringView("compactUpdates") },
+    { TypeDescriptorsCapability, QLatin1StringView("typeDescriptors") },
+    { LazyInitCapability, QLatin1StringView("lazyInit") },
+    { PropertyInterestCapability, QLatin1StringView("propertyInterest") },
+    { ObjectHandlesCapability, QLatin1StringView("handles") },
+    { PackedArraysCapability, QLatin1StringView("packedArrays") },
+};
+
+QJsonObject capabilitiesToJson(ClientCapabilities capabilities)
+{
+    QJsonObject object;
+    for (const CapabilityName &entry : capabilityNames) {
+        if (capabilities.testFlag(entry.capability))
+            object[entry.name] = true;
+    }
+    return object;
+}
+
+void writeCbor(QCborStreamWriter &writer, const QJsonValue &value)
+{
+    switch (value.type()) {
+    case QJsonValue::Null:
+        writer.appendNull();
+        break;
+    case QJsonValue::Bool:
+        writer.append(value.toBool());
+        break;
+    case QJsonValue::Double: {
+        // JSON does not distinguish integers from floating point numbers, but CBOR does;
+        // pick the shortest encoding that represents the value exactly
+        const double number = value.toDouble();
+        constexpr double maxSafeInteger = 9007199254740992.;
+        if (!std::isfinite(number))
+            writer.appendNull(); // like in JSON, which cannot represent them
+        else if (number == 0 && std::signbit(number))
+            writer.append(-0.f); // the integer encoding would lose the sign
+        else if (std::trunc(number) == number && std::abs(number) < maxSafeInteger)
+            writer.append(qint64(number));
+        else if (double(float(number)) == number)
+            writer.append(float(number));
+        else
+            writer.append(number);
+        break;
+    }
+    case QJsonValue::String:
+        writer.append(value.toString());
+        break;
+    case QJsonValue::Array: {
+        const QJsonArray array = value.toArray();
+        writer.startArray(quint64(array.size()));
+        for (const QJsonValue &element : array)
+            writeCbor(writer, element);
+        writer.endArray();
+        break;
+    }
+    case QJsonValue::Object: {
+        const QJsonObject object = value.toObject();
+        writer.startMap(quint64(object.size()));
+        for (auto it = object.constBegin(), end = object.constEnd(); it != end; ++it) {
+            writer.append(it.key());
+            writeCbor(writer, it.value());
+        }
+        writer.endMap();
+        break;
+    }
+    case QJsonValue::Undefined:
+        writer.appendUndefined();
+        break;
+    }
+}
 
 QJsonObject createResponse(const QJsonValue &id, const QJsonValue &data)
 {
@@ -146,6 +254,426 @@ QJsonObject createResponse(const QJsonValue &id, const QJsonValue &data)
     return response;
 }
 
+// The changed property values and the notify signal arguments of an object, from which the
+// property updates for the individual clients are created.
+struct ObjectUpdate
+{
+    QList<std::pair<int, QJsonValue>> properties;
+    QList<std::pair<int, QJsonArray>> signalArguments;
+};
+
+bool isObserved(const QBitArray &observed, int propertyIndex)
+{
+    return propertyIndex < observed.size() && observed.testBit(propertyIndex);
+}
+
+bool isAnyObserved(const QBitArray &observed, const QBitArray &properties)
+{
+    const qsizetype size = std::min(observed.size(), properties.size());
+    for (qsizetype i = 0; i < size; ++i) {
+        if (observed.testBit(i) && properties.testBit(i))
+            return true;
+    }
+    return false;
+}
+
+bool containsTransport(const QBitArray &transports, qsizetype index)
+{
+    return index < transports.size() && transports.testBit(index);
+}
+
+void insertTransport(QBitArray &transports, qsizetype index)
+{
+    if (index >= transports.size())
+        transports.resize(index + 1);
+    transports.setBit(index);
+}
+
+bool containsTransports(const QBitArray &transports, const QBitArray &subset)
+{
+    for (qsizetype index = 0; index < subset.size(); ++index) {
+        if (subset.testBit(index) && !containsTransport(transports, index))
+            return false;
+    }
+    return true;
+}
+
+// Converters of container elements, producing the same values as QJsonValue::fromVariant
+template<typename T, typename JsonType = T>
+QJsonValue elementToJson(const void *data)
+{
+    return QJsonValue(JsonType(*static_cast<const T *>(data)));
+}
+
+template<typename T>
+QJsonValue floatingPointElementToJson(const void *data)
+{
+    // JSON cannot represent NaN and infinity
+    const double value = *static_cast<const T *>(data);
+    return qIsFinite(value) ? QJsonValue(value) : QJsonValue();
+}
+
+QJsonValue (*elementConverter(QMetaType type))(const void *)
+{
+    switch (type.id()) {
+    case QMetaType::Int:
+        return elementToJson<int>;
+    case QMetaType::UInt:
+        return elementToJson<uint, qint64>;
+    case QMetaType::LongLong:
+        return elementToJson<qint64>;
+    case QMetaType::Double:
+        return floatingPointElementToJson<double>;
+    case QMetaType::Float:
+        return floatingPointElementToJson<float>;
+    case QMetaType::Bool:
+        return elementToJson<bool>;
+    case QMetaType::QString:
+        return elementToJson<QString>;
+    default:
+        return nullptr;
+    }
+}
+
+QJsonArray sequenceToJson(const QMetaSequence &sequence, const void *container,
+                          QJsonValue (*toJson)(const void *))
+{
+    QJsonArray array;
+    // a single buffer receives all elements
+    QVariant element(sequence.valueMetaType());
+    void *it = sequence.constBegin(container);
+    void *end = sequence.constEnd(container);
+    for (; !sequence.compareConstIterator(it, end); sequence.advanceConstIterator(it, 1)) {
+        sequence.valueAtConstIterator(it, element.data());
+        array.append(toJson(element.constData()));
+    }
+    sequence.destroyConstIterator(it);
+    sequence.destroyConstIterator(end);
+    return array;
+}
+
+QJsonObject associationToJson(const QMetaAssociation &association, const void *container,
+                              QJsonValue (*toJson)(const void *))
+{
+    QJsonObject object;
+    QString key;
+    QVariant mapped(association.mappedMetaType());
+    void *it = association.constBegin(container);
+    void *end = association.constEnd(container);
+    for (; !association.compareConstIterator(it, end); association.advanceConstIterator(it, 1)) {
+        association.keyAtConstIterator(it, &key);
+        association.mappedAtConstIterator(it, mapped.data());
+        object.insert(key, toJson(mapped.constData()));
+    }
+    association.destroyConstIterator(it);
+    association.destroyConstIterator(end);
+    return object;
+}
+
+// Lists of numbers are packed as base64 encoded little endian buffers, which the client decodes
+// to the typed array of the given name, see PackedArraysCapability
+struct PackedArrayType
+{
+    QMetaType listType;
+    QLatin1StringView name;
+    QString (*pack)(const void *list);
+};
+
+template<typename T>
+QString packArray(const void *data)
+{
+    const QList<T> &list = *static_cast<const QList<T> *>(data);
+    const qsizetype size = list.size() * qsizetype(sizeof(T));
+    if constexpr (QSysInfo::ByteOrder == QSysInfo::LittleEndian) {
+        const QByteArray bytes =
+                QByteArray::fromRawData(reinterpret_cast<const char *>(list.constData()), size);
+        return QString::fromLatin1(bytes.toBase64());
+    } else {
+        QByteArray bytes(size, Qt::Uninitialized);
+        qToLittleEndian<T>(list.constData(), list.size(), bytes.data());
+        return QString::fromLatin1(bytes.toBase64());
+    }
+}
+
+const PackedArrayType *packedArrayType(QMetaType type)
+{
+    static const PackedArrayType types[] = {
+        { QMetaType::fromType<QList<float>>(), QLatin1StringView("f32"), packArray<float> },
+        { QMetaType::fromType<QList<double>>(), QLatin1StringView("f64"), packArray<double> },
+        { QMetaType::fromType<QList<qint32>>(), QLatin1StringView("i32"), packArray<qint32> },
+    };
+    for (const PackedArrayType &packed : types) {
+        if (packed.listType == type)
+            return &packed;
+    }
+    return nullptr;
+}
+
+// Converters of method arguments and property values, the specialized ones skip the generic
+// conversion when the JSON value has a matching type and is within the range of the argument.
+// Numbers are rounded like QVariant does.
+bool convertArgument(const QMetaObjectPublisher &publisher,
+                     QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                     QMetaType type, void *argument)
+{
+    QVariant converted = publisher.toVariant(value, type.id(), transport);
+    if (type.id() == QMetaType::QVariant && converted.metaType() != type)
+        converted = QVariant(type, &converted);
+    // this also casts QObject pointers to the class of the argument
+    return QMetaType::convert(converted.metaType(), converted.constData(), type, argument);
+}
+
+bool convertIntArgument(const QMetaObjectPublisher &publisher,
+                        QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                        QMetaType type, void *argument)
+{
+    if (value.isDouble()) {
+        const double number = value.toDouble();
+        if (number >= std::numeric_limits<int>::min()
+            && number <= std::numeric_limits<int>::max()) {
+            *static_cast<int *>(argument) = int(qRound64(number));
+            return true;
+        }
+    }
+    return convertArgument(publisher, transport, value, type, argument);
+}
+
+bool convertLongLongArgument(const QMetaObjectPublisher &publisher,
+                             QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                             QMetaType type, void *argument)
+{
+    if (value.isDouble()) {
+        const double number = value.toDouble();
+        constexpr double limit = 9223372036854775808.; // 2^63
+        if (number >= -limit && number < limit) {
+            *static_cast<qlonglong *>(argument) = value.toInteger(qRound64(number));
+            return true;
+        }
+    }
+    return convertArgument(publisher, transport, value, type, argument);
+}
+
+bool convertFloatArgument(const QMetaObjectPublisher &publisher,
+                          QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                          QMetaType type, void *argument)
+{
+    if (value.isDouble()) {
+        *static_cast<float *>(argument) = float(value.toDouble());
+        return true;
+    }
+    return convertArgument(publisher, transport, value, type, argument);
+}
+
+bool convertStringArgument(const QMetaObjectPublisher &publisher,
+                           QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                           QMetaType type, void *argument)
+{
+    if (value.isString()) {
+        *static_cast<QString *>(argument) = value.toString();
+        return true;
+    }
+    return convertArgument(publisher, transport, value, type, argument);
+}
+
+bool convertBoolArgument(const QMetaObjectPublisher &publisher,
+                         QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                         QMetaType type, void *argument)
+{
+    if (value.isBool()) {
+        *static_cast<bool *>(argument) = value.toBool();
+        return true;
+    }
+    return convertArgument(publisher, transport, value, type, argument);
+}
+
+bool convertDoubleArgument(const QMetaObjectPublisher &publisher,
+                           QWebChannelAbstractTransport *transport, const QJsonValue &value,
+                           QMetaType type, void *argument)
+{
+    if (value.isDouble()) {
+        *static_cast<double *>(argument) = value.toDouble();
+        return true;
+    }
+    return convertArgument(publisher, transport, value, type, argument);
+}
+
+// Returns the converter for values of the given type
+QMetaObjectPublisher::MethodInvoker::ArgumentConverter argumentConverter(QMetaType type)
+{
+    switch (type.id()) {
+    case QMetaType::Bool:
+        return convertBoolArgument;
+    case QMetaType::Int:
+        return convertIntArgument;
+    case QMetaType::LongLong:
+        return convertLongLongArgument;
+    case QMetaType::Float:
+        return convertFloatArgument;
+    case QMetaType::Double:
+        return convertDoubleArgument;
+    case QMetaType::QString:
+        return convertStringArgument;
+    default:
+        return convertArgument;
+    }
+}
+
+// Creates the update of the object with the given address in the compact or the object format.
+// When observed is set, only the observed properties and the signals notifying them are included.
+QJsonObject createObjectUpdate(const QJsonValue &objectAddress, const ObjectUpdate &update,
+                               bool compact,
+                               const QBitArray *observed = nullptr,
+                               const QHash<int, QBitArray> &notifiedProperties = {})
+{
+    QJsonArray compactProperties;
+    QJsonObject properties;
+    for (const auto &property : update.properties) {
+        if (observed && !isObserved(*observed, property.first))
+            continue;
+        if (compact) {
+            compactProperties.push_back(property.first);
+            compactProperties.push_back(property.second);
+        } else {
+            properties[QString::number(property.first)] = property.second;
+        }
+    }
+
+    QJsonArray compactSigs;
+    QJsonObject sigs;
+    for (const auto &signal : update.signalArguments) {
+        if (observed && !isAnyObserved(*observed, notifiedProperties.value(signal.first)))
+            continue;
+        if (compact) {
+            compactSigs.push_back(signal.first);
+            compactSigs.push_back(signal.second);
+        } else {
+            sigs[QString::number(signal.first)] = signal.second;
+        }
+    }
+
+    QJsonObject obj;
+    if (observed && compactProperties.isEmpty() && properties.isEmpty() && compactSigs.isEmpty()
+        && sigs.isEmpty()) {
+        // nothing the client is interested in
+        return obj;
+    }
+    obj[KEY_OBJECT] = objectAddress;
+    if (compact) {
+        obj[KEY_SIGNALS] = compactSigs;
+        obj[KEY_PROPERTIES] = compactProperties;
+    } else {
+        obj[KEY_SIGNALS] = sigs;
+        obj[KEY_PROPERTIES] = properties;
+    }
+    return obj;
+}
+
+// Collects the latest property values and signal arguments of an object from several updates
+// created by createObjectUpdate.
+struct ObjectUpdateMerger
+{
+    void mergeProperty(int propertyIndex, const QJsonValue &value)
+    {
+        const auto position = propertyPositions.constFind(propertyIndex);
+        if (position != propertyPositions.constEnd()) {
+            properties[*position].second = value;
+        } else {
+            propertyPositions.insert(propertyIndex, properties.size());
+            properties.append({ propertyIndex, value });
+        }
+    }
+
+    void mergeSignal(int signalIndex, const QJsonArray &arguments)
+    {
+        // signals are ordered by their last emission
+        signalArguments[signalIndex] = { emissions++, arguments };
+    }
+
+    void merge(const QJsonObject &objectUpdate)
+    {
+        const QJsonValue propertyValues = objectUpdate.value(KEY_PROPERTIES);
+        if (propertyValues.isArray()) {
+            const QJsonArray array = propertyValues.toArray();
+            for (qsizetype i = 0; i + 1 < array.size(); i += 2)
+                mergeProperty(array.at(i).toInt(), array.at(i + 1));
+        } else {
+            const QJsonObject object = propertyValues.toObject();
+            for (auto it = object.constBegin(), end = object.constEnd(); it != end; ++it)
+                mergeProperty(it.key().toInt(), it.value());
+        }
+
+        const QJsonValue sigs = objectUpdate.value(KEY_SIGNALS);
+        if (sigs.isArray()) {
+            const QJsonArray array = sigs.toArray();
+            for (qsizetype i = 0; i + 1 < array.size(); i += 2)
+                mergeSignal(array.at(i).toInt(), array.at(i + 1).toArray());
+        } else {
+            const QJsonObject object = sigs.toObject();
+            for (auto it = object.constBegin(), end = object.constEnd(); it != end; ++it)
+                mergeSignal(it.key().toInt(), it.value().toArray());
+        }
+    }
+
+    ObjectUpdate result() const
+    {
+        ObjectUpdate update;
+        update.properties = properties;
+        QList<std::pair<qsizetype, int>> order;
+        order.reserve(signalArguments.size());
+        for (auto it = signalArguments.constBegin(), end = signalArguments.constEnd(); it != end; ++it)
+            order.append({ it.value().first, it.key() });
+        std::sort(order.begin(), order.end());
+        for (const auto &signal : std::as_const(order))
+            update.signalArguments.append({ signal.second, signalArguments.value(signal.second).second });
+        return update;
+    }
+
+    QList<std::pair<int, QJsonValue>> properties;
+    QHash<int, qsizetype> propertyPositions;
+    // maps signal indexes to the order of their last emission and its arguments
+    QHash<int, std::pair<qsizetype, QJsonArray>> signalArguments;
+    qsizetype emissions = 0;
+};
+
+bool isPropertyUpdate(const QJsonObject &message)
+{
+    return message.value(KEY_TYPE).toInt() == TypePropertyUpdate;
+}
+
+// Merges the property update messages into a single one with the latest values per object.
+QJsonObject mergePropertyUpdates(const QList<QJsonObject> &messages)
+{
+    QList<QJsonValue> objectAddresses;
+    // keyed by the object id or handle, a client uses either of them for all objects
+    QHash<QString, ObjectUpdateMerger> mergers;
+    const auto key = [](const QJsonValue &address) {
+        return address.isString() ? address.toString() : QString::number(address.toInteger());
+    };
+    bool compact = false;
+    for (const QJsonObject &message : messages) {
+        const QJsonArray data = message.value(KEY_DATA).toArray();
+        for (const QJsonValue &value : data) {
+            const QJsonObject objectUpdate = value.toObject();
+            const QJsonValue objectAddress = objectUpdate.value(KEY_OBJECT);
+            if (!mergers.contains(key(objectAddress)))
+                objectAddresses.append(objectAddress);
+            compact = objectUpdate.value(KEY_PROPERTIES).isArray();
+            mergers[key(objectAddress)].merge(objectUpdate);
+        }
+    }
+
+    QJsonArray data;
+    for (const QJsonValue &objectAddress : std::as_const(objectAddresses)) {
+        const ObjectUpdate update = mergers.value(key(objectAddress)).result();
+        // only the compact format keeps the signals in the order of their last emission
+        data.append(createObjectUpdate(objectAddress, update, compact));
+    }
+    QJsonObject message;
+    message[KEY_TYPE] = TypePropertyUpdate;
+    message[KEY_DATA] = data;
+    return message;
+}
+
 #if QT_CONFIG(future)
 QMetaType resultTypeOfQFuture(QByteArrayView typeName)
 {
@@ -262,33 +790,33 @@ QMetaObjectPublisher::~QMetaObjectPublisher()
 
 void QMetaObjectPublisher::registerObject(const QString &id, QObject *object)
 {
+    if (const auto wrapped = wrappedObjects.constFind(id);
+        wrapped != wrappedObjects.constEnd() && wrapped->object) {
+        qWarning() << "Cannot register object with id" << id
+                   << "which is already used by a wrapped object.";
+        return;
+    }
     registeredObjects[id] = object;
     registeredObjectIds[object] = id;
+    if (!objectHandles.contains(object))
+        assignHandle(object);
     if (propertyUpdatesInitialized) {
         if (!webChannel->d_func()->transports.isEmpty()) {
             qWarning("Registered new object after initialization, existing clients won't be notified!");
             // TODO: send a message to clients that an object was added
         }
-        initializePropertyUpdates(object, classInfoForObject(object, nullptr));
+        initializePropertyUpdates(object, classDescriptor(object));
     }
 }
 
-QJsonObject QMetaObjectPublisher::classInfoForObject(const QObject *object, QWebChannelAbstractTransport *transport)
+QMetaObjectPublisher::ClassDescriptor
+QMetaObjectPublisher::createClassDescriptor(const QMetaObject *metaObject)
 {
-    QJsonObject data;
-    if (!object) {
-        qWarning("null object given to MetaObjectPublisher - bad API usage?");
-        return data;
-    }
-
-    QJsonArray qtSignals;
-    QJsonArray qtMethods;
-    QJsonArray qtProperties;
-    QJsonObject qtEnums;
+    ClassDescriptor descriptor;
 
-    const QMetaObject *metaObject = object->metaObject();
     QSet<int> notifySignals;
     QSet<QString> identifiers;
+    descriptor.properties.reserve(metaObject->propertyCount());
     for (int i = 0; i < metaObject->propertyCount(); ++i) {
         const QMetaProperty &prop = metaObject->property(i);
         QJsonArray propertyInfo;
@@ -299,6 +827,10 @@ QJsonObject QMetaObjectPublisher::classInfoForObject(const QObject *object, QWeb
         QJsonArray signalInfo;
         if (prop.hasNotifySignal()) {
             notifySignals << prop.notifySignalIndex();
+            QBitArray &notifiedProperties = descriptor.notifySignals[prop.notifySignalIndex()];
+            if (notifiedProperties.isEmpty())
+                notifiedProperties.resize(metaObject->propertyCount());
+            notifiedProperties.setBit(i);
             // optimize: compress the common propertyChanged notification names, just send a 1
             const QByteArray &notifySignal = prop.notifySignal().name();
             static const QByteArray changedSuffix = QByteArrayLiteral("Changed");
@@ -310,16 +842,17 @@ QJsonObject QMetaObjectPublisher::classInfoForObject(const QObject *object, QWeb
                 signalInfo.append(QString::fromLatin1(notifySignal));
             }
             signalInfo.append(prop.notifySignalIndex());
-        } else if (!prop.isConstant() && !prop.isBindable()) {
+        } else if (prop.isBindable()) {
+            descriptor.bindableProperties << i;
+        } else if (!prop.isConstant()) {
             qWarning("Property '%s'' of object '%s' has no notify signal, is not bindable and is not constant, "
                      "value updates in HTML will be broken!",
-                     prop.name(), object->metaObject()->className());
+                     prop.name(), metaObject->className());
         }
         propertyInfo.append(signalInfo);
-        propertyInfo.append(wrapResult(prop.read(object), transport));
-        qtProperties.append(propertyInfo);
+        descriptor.properties.append(propertyInfo);
     }
-    auto addMethod = [&qtSignals, &qtMethods, &identifiers](int i, const QMetaMethod &method, const QByteArray &rawName) {
+    auto addMethod = [&descriptor, &identifiers](int i, const QMetaMethod &method, const QByteArray &rawName) {
         //NOTE: the name must be a string, otherwise it will be converted to '{}' in QML
         const auto name = QString::fromLatin1(rawName);
         // only the first method gets called with its name directly
@@ -332,9 +865,9 @@ QJsonObject QMetaObjectPublisher::classInfoForObject(const QObject *object, QWeb
         data.append(name);
         data.append(i);
         if (method.methodType() == QMetaMethod::Signal) {
-            qtSignals.append(data);
+            descriptor.qtSignals.append(data);
         } else if (method.access() == QMetaMethod::Public) {
-            qtMethods.append(data);
+            descriptor.qtMethods.append(data);
         }
     };
     for (int i = 0; i < metaObject->methodCount(); ++i) {
@@ -352,28 +885,121 @@ QJsonObject QMetaObjectPublisher::classInfoForObject(const QObject *object, QWeb
         for (int k = 0; k < enumerator.keyCount(); ++k) {
             values[QString::fromLatin1(enumerator.key(k))] = enumerator.value(k);
         }
-        qtEnums[QString::fromLatin1(enumerator.name())] = values;
+        descriptor.qtEnums[QString::fromLatin1(enumerator.name())] = values;
+    }
+    return descriptor;
+}
+
+QMetaObjectPublisher::ClassDescriptor QMetaObjectPublisher::classDescriptor(const QObject *object)
+{
+    const QMetaObject *metaObject = object->metaObject();
+    // dynamic meta objects, e.g. those of QML objects, are created per instance and may change
+    // over time, so they cannot be cached by their address
+    if (QObjectPrivate::get(object)->metaObject)
+        return createClassDescriptor(metaObject);
+
+    auto it = classDescriptors.constFind(metaObject);
+    if (it == classDescriptors.constEnd()) {
+        ClassDescriptor descriptor = createClassDescriptor(metaObject);
+        descriptor.typeId = int(classDescriptors.size());
+        it = classDescriptors.insert(metaObject, descriptor);
+    }
+    return it.value();
+}
+
+void QMetaObjectPublisher::attachPendingTypes(QJsonObject &response,
+                                              QWebChannelAbstractTransport *transport)
+{
+    auto found = transportState.find(transport);
+    if (found == transportState.end() || found.value().pendingTypes.isEmpty())
+        return;
+    response[KEY_TYPES] = std::exchange(found.value().pendingTypes, QJsonObject());
+}
+
+QJsonObject QMetaObjectPublisher::classInfoForObject(const QObject *object, QWebChannelAbstractTransport *transport)
+{
+    QJsonObject data;
+    if (!object) {
+        qWarning("null object given to MetaObjectPublisher - bad API usage?");
+        return data;
+    }
+
+    const ClassDescriptor descriptor = classDescriptor(object);
+    const QMetaObject *metaObject = object->metaObject();
+
+    // clients that address objects by handle learn it along with the object, without a transport
+    // it is added for the respective recipients by addObjectHandles
+    if (const qint64 handle = objectHandle(object);
+        handle >= 0 && transport && hasCapability(transport, ObjectHandlesCapability)) {
+        data[KEY_HANDLE] = handle;
+    }
+
+    if (transport && descriptor.typeId >= 0
+        && hasCapability(transport, TypeDescriptorsCapability)) {
+        // the client receives the class information once and only needs the property values
+        TransportState &state = transportState[transport];
+        if (!state.knownTypes.contains(descriptor.typeId)) {
+            state.knownTypes.insert(descriptor.typeId);
+            QJsonObject type;
+            type[KEY_SIGNALS] = descriptor.qtSignals;
+            type[KEY_METHODS] = descriptor.qtMethods;
+            QJsonArray properties;
+            for (const QJsonArray &propertyInfo : descriptor.properties)
+                properties.append(propertyInfo);
+            type[KEY_PROPERTIES] = properties;
+            if (!descriptor.qtEnums.isEmpty())
+                type[KEY_ENUMS] = descriptor.qtEnums;
+            state.pendingTypes[QString::number(descriptor.typeId)] = type;
+        }
+
+        QJsonArray values;
+        for (int i = 0; i < descriptor.properties.size(); ++i)
+            values.append(wrapResult(metaObject->property(i).read(object), transport));
+        data[KEY_TYPE] = descriptor.typeId;
+        data[KEY_VALUES] = values;
+        return data;
     }
-    data[KEY_SIGNALS] = qtSignals;
-    data[KEY_METHODS] = qtMethods;
+
+    // only the property values differ between objects of the same class
+    QJsonArray qtProperties;
+    for (int i = 0; i < descriptor.properties.size(); ++i) {
+        QJsonArray propertyInfo = descriptor.properties.at(i);
+        propertyInfo.append(wrapResult(metaObject->property(i).read(object), transport));
+        qtProperties.append(propertyInfo);
+    }
+
+    data[KEY_SIGNALS] = descriptor.qtSignals;
+    data[KEY_METHODS] = descriptor.qtMethods;
     data[KEY_PROPERTIES] = qtProperties;
-    if (!qtEnums.isEmpty()) {
-        data[KEY_ENUMS] = qtEnums;
+    if (!descriptor.qtEnums.isEmpty()) {
+        data[KEY_ENUMS] = descriptor.qtEnums;
     }
     return data;
 }
 
 void QMetaObjectPublisher::setClientIsIdle(bool isIdle, QWebChannelAbstractTransport *transport)
 {
-    transportState[transport].clientIsIdle = isIdle;
+    TransportState &state = transportState[transport];
+    state.credits = isIdle ? qMax(state.credits, 1) : 0;
     if (isIdle)
         sendEnqueuedPropertyUpdates(transport);
 }
 
+void QMetaObjectPublisher::grantCredits(int credits, QWebChannelAbstractTransport *transport)
+{
+    TransportState &state = transportState[transport];
+    if (state.creditWindow == 0) {
+        setClientIsIdle(true, transport);
+        return;
+    }
+    state.credits = qBound(0, state.credits + credits, state.creditWindow);
+    sendEnqueuedPropertyUpdates(transport);
+}
+
 bool QMetaObjectPublisher::isClientIdle(QWebChannelAbstractTransport *transport)
 {
     auto found = transportState.find(transport);
-    return found != transportState.end() && found.value().clientIsIdle;
+    return found != transportState.end() && found.value().credits > 0;
 }
 
 QJsonObject QMetaObjectPublisher::initializeClient(QWebChannelAbstractTransport *transport)
@@ -382,54 +1008,66 @@ QJsonObject QMetaObjectPublisher::initializeClient(QWebChannelAbstractTransport
     {
         const QHash<QString, QObject *>::const_iterator end = registeredObjects.constEnd();
         for (QHash<QString, QObject *>::const_iterator it = registeredObjects.constBegin(); it != end; ++it) {
-            const QJsonObject &info = classInfoForObject(it.value(), transport);
+            objectInfos[it.key()] = classInfoForObject(it.value(), transport);
             if (!propertyUpdatesInitialized) {
-                initializePropertyUpdates(it.value(), info);
+                initializePropertyUpdates(it.value(), classDescriptor(it.value()));
             }
-            objectInfos[it.key()] = info;
         }
     }
     propertyUpdatesInitialized = true;
     return objectInfos;
 }
 
-void QMetaObjectPublisher::initializePropertyUpdates(QObject *const object, const QJsonObject &objectInfo)
+QJsonArray QMetaObjectPublisher::initializeLazyClient()
 {
-    auto *metaObject = object->metaObject();
-    auto *signalHandler = signalHandlerFor(object);
-    for (const auto propertyInfoVar : objectInfo[KEY_PROPERTIES].toArray()) {
-        const QJsonArray &propertyInfo = propertyInfoVar.toArray();
-        if (propertyInfo.size() < 2) {
-            qWarning() << "Invalid property info encountered:" << propertyInfoVar;
-            continue;
-        }
-        const int propertyIndex = propertyInfo.at(0).toInt();
-        const QJsonArray &signalData = propertyInfo.at(2).toArray();
-        const QMetaProperty metaProp = metaObject->property(propertyIndex);
-
-        if (!signalData.isEmpty()) {
-            // Property with a NOTIFY signal
-            const int signalIndex = signalData.at(1).toInt();
+    QJsonArray objectIds;
+    for (auto it = registeredObjects.constBegin(), end = registeredObjects.constEnd(); it != end; ++it) {
+        objectIds.append(it.key());
+        if (!propertyUpdatesInitialized)
+            initializePropertyUpdates(it.value(), classDescriptor(it.value()));
+    }
+    propertyUpdatesInitialized = true;
+    return objectIds;
+}
 
-            QSet<int> &connectedProperties = signalToPropertyMap[object][signalIndex];
+void QMetaObjectPublisher::initializePropertyUpdates(QObject *const object,
+                                                     const ClassDescriptor &descriptor)
+{
+    auto *signalHandler = signalHandlerFor(object);
 
-            // Only connect for a property update once
+    auto connected = signalToPropertyMap.find(object);
+    if (connected == signalToPropertyMap.end()) {
+        for (auto it = descriptor.notifySignals.cbegin(); it != descriptor.notifySignals.cend(); ++it)
+            signalHandler->connectTo(object, it.key());
+        // shares the map of the class descriptor
+        signalToPropertyMap.insert(object, descriptor.notifySignals);
+    } else if (!connected->isSharedWith(descriptor.notifySignals)) {
+        // Only connect for a property update once. A dynamic meta object may have gained
+        // properties since the object was initialized, merge those into the existing map.
+        for (auto it = descriptor.notifySignals.cbegin(); it != descriptor.notifySignals.cend(); ++it) {
+            QBitArray &connectedProperties = (*connected)[it.key()];
             if (connectedProperties.isEmpty()) {
-                signalHandler->connectTo(object, signalIndex);
+                signalHandler->connectTo(object, it.key());
+                connectedProperties = it.value();
+            } else {
+                if (connectedProperties.size() < it->size())
+                    connectedProperties.resize(it->size());
+                connectedProperties |= it.value();
             }
+        }
+    }
 
-            connectedProperties.insert(propertyIndex);
-        } else if (metaProp.isBindable()) {
-            const auto [begin, end] = propertyObservers.equal_range(object);
-            const auto it = std::find_if(begin, end, [&](auto &n) {
-                return n.second.propertyIndex == propertyIndex;
-            });
-            // Only connect for a property update once
-            if (it == end) {
-                auto it = propertyObservers.emplace(
-                            object, QWebChannelPropertyChangeNotifier{this, object, propertyIndex});
-                metaProp.bindable(object).observe(&it->second);
-            }
+    auto *metaObject = object->metaObject();
+    for (const int propertyIndex : descriptor.bindableProperties) {
+        const auto [begin, end] = propertyObservers.equal_range(object);
+        const auto it = std::find_if(begin, end, [&](auto &n) {
+            return n.second.propertyIndex == propertyIndex;
+        });
+        // Only connect for a property update once
+        if (it == end) {
+            auto it = propertyObservers.emplace(
+                        object, QWebChannelPropertyChangeNotifier{this, object, propertyIndex});
+            metaObject->property(propertyIndex).bindable(object).observe(&it->second);
         }
     }
 
@@ -443,98 +1081,207 @@ void QMetaObjectPublisher::sendPendingPropertyUpdates()
         return;
     }
 
-    QJsonArray data;
+    // only build the update formats which the connected clients negotiated
+    bool neededFormats[UpdateFormatCount] = {};
+    for (auto *transport : webChannel->d_func()->transports) {
+        if (!hasCapability(transport, PropertyInterestCapability))
+            neededFormats[updateFormat(transport)] = true;
+    }
+
+    std::array<QJsonArray, UpdateFormatCount> data;
+    bool hasBroadcastUpdates = false;
     QHash<QWebChannelAbstractTransport*, QJsonArray> specificUpdates;
 
-    // convert pending property updates to JSON data
-    const PendingPropertyUpdates::const_iterator end = pendingPropertyUpdates.constEnd();
-    for (PendingPropertyUpdates::const_iterator it = pendingPropertyUpdates.constBegin(); it != end; ++it) {
-        const QObject *object = it.key();
+    // convert pending property updates to JSON data, updates that happen meanwhile are sent the
+    // next time
+    const QList<qsizetype> dirtySlots = std::exchange(dirtyObjectSlots, {});
+    deferClassInfoSent = true;
+    deferredClassInfo = false;
+    for (const qsizetype slot : dirtySlots) {
+        const PropertyUpdate pending = std::exchange(pendingPropertyUpdates[slot], {});
+        const QObject *object = objectSlots.at(slot).object;
+        Q_ASSERT(object);
         const QMetaObject *const metaObject = object->metaObject();
         const QString objectId = registeredObjectIds.value(object);
         const SignalToPropertyNameMap &objectsSignalToPropertyMap = signalToPropertyMap.value(object);
-        // maps property name to current property value
-        QJsonObject properties;
-        // maps signal index to list of arguments of the last emit
-        QJsonObject sigs;
+        const auto wrapped = wrappedObjects.constFind(objectId);
+        const bool isWrapped = wrapped != wrappedObjects.constEnd();
+        // if the object is auto registered, just send the update only to clients which know this object
+        const QList<QWebChannelAbstractTransport *> recipients = isWrapped
+                ? transportsInSet(wrapped->transports)
+                : webChannel->d_func()->transports;
+
+        // only read the properties that at least one of the clients is interested in
+        bool needsAllProperties = false;
+        QBitArray observed;
+        for (auto *transport : recipients) {
+            if (!hasCapability(transport, PropertyInterestCapability)) {
+                needsAllProperties = true;
+                break;
+            }
+            observed |= observedProperties(transport, object);
+        }
+        if (!needsAllProperties && observed.count(true) == 0)
+            continue;
 
-        const auto indexes = it.value().propertyIndices(objectsSignalToPropertyMap);
+        // the recipients of every property, so that wrapped objects are only described to
+        // clients that do not know them yet
+        QBitArray allPropertiesRecipients;
+        QList<std::pair<qsizetype, QBitArray>> observingRecipients;
+        for (auto *transport : recipients) {
+            if (hasCapability(transport, PropertyInterestCapability))
+                observingRecipients.append({ transportIndex(transport), observedProperties(transport, object) });
+            else
+                insertTransport(allPropertiesRecipients, transportIndex(transport));
+        }
 
-        // TODO: can we get rid of the int <-> string conversions here?
-        for (const int propertyIndex : indexes) {
+        ObjectUpdate update;
+        for (int propertyIndex = 0; propertyIndex < pending.properties.size(); ++propertyIndex) {
+            if (!pending.properties.testBit(propertyIndex)
+                || (!needsAllProperties && !isObserved(observed, propertyIndex))) {
+                continue;
+            }
+            QBitArray propertyRecipients = allPropertiesRecipients;
+            for (const auto &[index, transportObserved] : std::as_const(observingRecipients)) {
+                if (isObserved(transportObserved, propertyIndex))
+                    insertTransport(propertyRecipients, index);
+            }
             const QMetaProperty &property = metaObject->property(propertyIndex);
             Q_ASSERT(property.isValid());
-            properties[QString::number(propertyIndex)] = wrapResult(property.read(object), nullptr, objectId);
+            update.properties.append(
+                    { propertyIndex, wrapResult(property.read(object), nullptr, objectId,
+                                                propertyRecipients) });
         }
-
-        const auto sigMap = it.value().signalMap;
-        for (auto sigIt = sigMap.constBegin(); sigIt != sigMap.constEnd(); ++sigIt) {
-            sigs[QString::number(sigIt.key())] = QJsonArray::fromVariantList(sigIt.value());
+        update.signalArguments = pending.signalArguments;
+
+        // clients that address objects by handle also learn the handles of the wrapped values
+        ObjectUpdate handleUpdate;
+        if (std::any_of(recipients.cbegin(), recipients.cend(), [this](auto *transport) {
+                return hasCapability(transport, ObjectHandlesCapability);
+            })) {
+            handleUpdate = update;
+            for (auto &property : handleUpdate.properties)
+                property.second = addObjectHandles(property.second);
+        }
+        const auto formatUpdate = [&](int format) -> const ObjectUpdate & {
+            return format & HandleUpdateFormat ? handleUpdate : update;
+        };
+
+        std::array<QJsonObject, UpdateFormatCount> objectUpdates;
+        for (int format = 0; format < UpdateFormatCount; ++format) {
+            if (neededFormats[format]) {
+                objectUpdates[format] = createObjectUpdate(
+                        objectAddress(object, objectId, format & HandleUpdateFormat),
+                        formatUpdate(format), format & CompactUpdateFormat);
+            }
         }
 
-        QJsonObject obj;
-        obj[KEY_OBJECT] = objectId;
-        obj[KEY_SIGNALS] = sigs;
-        obj[KEY_PROPERTIES] = properties;
-
-        // if the object is auto registered, just send the update only to clients which know this object
-        if (wrappedObjects.contains(objectId)) {
-            for (QWebChannelAbstractTransport *transport : wrappedObjects.value(objectId).transports) {
-                QJsonArray &arr = specificUpdates[transport];
-                arr.push_back(obj);
+        for (QWebChannelAbstractTransport *transport : recipients) {
+            const int format = updateFormat(transport);
+            if (hasCapability(transport, PropertyInterestCapability)) {
+                const QBitArray transportObserved = observedProperties(transport, object);
+                const QJsonObject filtered = createObjectUpdate(
+                        objectAddress(object, objectId, format & HandleUpdateFormat),
+                        formatUpdate(format), format & CompactUpdateFormat, &transportObserved,
+                        objectsSignalToPropertyMap);
+                if (!filtered.isEmpty())
+                    specificUpdates[transport].push_back(filtered);
+            } else if (isWrapped) {
+                specificUpdates[transport].push_back(objectUpdates[format]);
             }
-        } else {
-            data.push_back(obj);
+        }
+        if (!isWrapped && needsAllProperties) {
+            for (int format = 0; format < UpdateFormatCount; ++format)
+                data[format].push_back(objectUpdates[format]);
+            hasBroadcastUpdates = true;
         }
     }
+    deferClassInfoSent = false;
 
-    pendingPropertyUpdates.clear();
     QJsonObject message;
     message[KEY_TYPE] = TypePropertyUpdate;
 
     // data does not contain specific updates
-    if (!data.isEmpty()) {
-        message[KEY_DATA] = data;
-        enqueueBroadcastMessage(message);
+    if (hasBroadcastUpdates) {
+        std::array<QJsonObject, UpdateFormatCount> messages;
+        for (int format = 0; format < UpdateFormatCount; ++format) {
+            messages[format] = message;
+            if (neededFormats[format])
+                messages[format][KEY_DATA] = data[format];
+        }
+        enqueueBroadcastMessage(messages, deferredClassInfo);
     }
 
     // send every property update which is not supposed to be broadcasted
     const QHash<QWebChannelAbstractTransport*, QJsonArray>::const_iterator suend = specificUpdates.constEnd();
     for (QHash<QWebChannelAbstractTransport*, QJsonArray>::const_iterator it = specificUpdates.constBegin(); it != suend; ++it) {
         message[KEY_DATA] = it.value();
-        enqueueMessage(message, it.key());
+        enqueueMessage(message, it.key(), deferredClassInfo);
     }
 
     for (auto state = transportState.begin(); state != transportState.end(); ++state)
         sendEnqueuedPropertyUpdates(state.key());
 }
 
+const QMetaObjectPublisher::MethodInvoker &
+QMetaObjectPublisher::methodInvoker(const QMetaMethod &method)
+{
+    const std::pair<const QMetaObject *, int> key(method.enclosingMetaObject(),
+                                                  method.methodIndex());
+    const auto it = methodInvokers.find(key);
+    if (it != methodInvokers.end())
+        return it->second;
+    return methodInvokers.emplace(key, createMethodInvoker(method)).first->second;
+}
+
+QMetaObjectPublisher::MethodInvoker
+QMetaObjectPublisher::createMethodInvoker(const QMetaMethod &method)
+{
+    MethodInvoker invoker;
+    const QMetaType returnType = method.returnMetaType();
+    invoker.types << returnType;
+    invoker.names << returnType.name();
+    invoker.metaTypes << returnType.iface();
+    for (int i = 0; i < method.parameterCount(); ++i) {
+        const QMetaType type = method.parameterMetaType(i);
+        invoker.types << type;
+        invoker.names << type.name();
+        invoker.metaTypes << type.iface();
+        invoker.converters << argumentConverter(type);
+    }
+    return invoker;
+}
+
 QVariant QMetaObjectPublisher::invokeMethod_helper(QObject *const object, const QMetaMethod &method,
-                                                   const QJsonArray &args)
+                                                   const QJsonArray &args,
+                                                   QWebChannelAbstractTransport *transport)
 {
     // a good value for the number of arguments we'll preallocate in QVLA
     constexpr qsizetype ArgumentCount = 16;
 
+    // dynamic meta objects, e.g. those of QML objects, are created per instance, so their
+    // methods cannot be cached by the address of the meta object
+    MethodInvoker uncachedInvoker;
+    const MethodInvoker &invoker = QObjectPrivate::get(object)->metaObject
+            ? (uncachedInvoker = createMethodInvoker(method))
+            : methodInvoker(method);
+    const auto &names = invoker.names;
     QVarLengthArray<QVariant, ArgumentCount> variants;
-    QVarLengthArray<const char *, ArgumentCount> names(method.parameterCount() + 1);
     QVarLengthArray<void *, ArgumentCount> parameters(names.size());
-    QVarLengthArray<const QtPrivate::QMetaTypeInterface *, ArgumentCount> metaTypes(names.size());
     variants.reserve(names.size());
     variants << QVariant();
 
-    // start with the formal parameters
+    // start with the formal parameters, which are converted in place; if that fails, the
+    // argument keeps its default value
     for (qsizetype i = 0; i < names.size() - 1; ++i) {
-        QMetaType mt = method.parameterMetaType(i);
-        QVariant &v = variants.emplace_back(toVariant(args.at(i), mt.id()));
+        const QMetaType type = invoker.types[i + 1];
+        QVariant &v = variants.emplace_back(type);
+        invoker.converters[i](*this, transport, args.at(i), type, v.data());
         parameters[i + 1] = v.data();
-        names[i + 1] = mt.name();
-        metaTypes[i + 1] = mt.iface();
     }
 
     // now, the return type
-    QMetaType mt = method.returnMetaType();
-    names[0] = mt.name();
-    metaTypes[0] = mt.iface();
+    const QMetaType mt = invoker.types[0];
     if (int id = mt.id(); id != QMetaType::Void) {
         // Only init variant with return type if its not a variant itself,
         // which would lead to nested variants which is not what we want.
@@ -552,7 +1299,7 @@ QVariant QMetaObjectPublisher::invokeMethod_helper(QObject *const object, const
     QMetaMethodInvoker::InvokeFailReason r =
             QMetaMethodInvoker::invokeImpl(method, object, Qt::AutoConnection,
                                            parameters.size(), parameters.constData(),
-                                           names.constData(), metaTypes.constData());
+                                           names.constData(), invoker.metaTypes.constData());
 
     if (r == QMetaMethodInvoker::InvokeFailReason::None)
         return variants.first();
@@ -570,7 +1317,8 @@ QVariant QMetaObjectPublisher::invokeMethod_helper(QObject *const object, const
 }
 
 QVariant QMetaObjectPublisher::invokeMethod(QObject *const object, const QMetaMethod &method,
-                                              const QJsonArray &args)
+                                              const QJsonArray &args,
+                                              QWebChannelAbstractTransport *transport)
 {
     if (method.name() == QByteArrayLiteral("deleteLater")) {
         // invoke `deleteLater` on wrapped QObject indirectly
@@ -590,11 +1338,12 @@ QVariant QMetaObjectPublisher::invokeMethod(QObject *const object, const QMetaMe
                    << args.size() << "arguments given, but method only takes" << method.parameterCount() << '.';
     }
 
-    return invokeMethod_helper(object, method, args);
+    return invokeMethod_helper(object, method, args, transport);
 }
 
 QVariant QMetaObjectPublisher::invokeMethod(QObject *const object, const int methodIndex,
-                                            const QJsonArray &args)
+                                            const QJsonArray &args,
+                                            QWebChannelAbstractTransport *transport)
 {
     const QMetaMethod &method = object->metaObject()->method(methodIndex);
     if (!method.isValid()) {
@@ -602,96 +1351,295 @@ QVariant QMetaObjectPublisher::invokeMethod(QObject *const object, const int met
                    << object << '.';
         return QJsonValue();
     }
-    return invokeMethod(object, method, args);
+    return invokeMethod(object, method, args, transport);
 }
 
 QVariant QMetaObjectPublisher::invokeMethod(QObject *const object, const QByteArray &methodName,
-                                            const QJsonArray &args)
-{
-    QList<OverloadResolutionCandidate> candidates;
-
-    const QMetaObject *mo = object->metaObject();
-    for (int i = 0; i < mo->methodCount(); ++i) {
-        QMetaMethod method = mo->method(i);
-        if (method.name() != methodName || method.parameterCount() != args.count()
-                || method.access() != QMetaMethod::Public
-                || (method.methodType() != QMetaMethod::Method
-                        && method.methodType() != QMetaMethod::Slot))
-        {
-            // Not a candidate
-            continue;
+                                            const QJsonArray &args,
+                                            QWebChannelAbstractTransport *transport)
+{
+    // dynamic meta objects, e.g. those of QML objects, are created per instance, so the
+    // resolution cannot be cached by the address of the meta object
+    const bool isDynamic = QObjectPrivate::get(object)->metaObject;
+    OverloadResolutionKey key;
+    auto cached = overloadResolutions.constEnd();
+    if (!isDynamic) {
+        key = { object->metaObject(), methodName, argumentKinds(args, transport) };
+        cached = overloadResolutions.constFind(key);
+    }
+
+    OverloadResolution resolution;
+    if (cached != overloadResolutions.constEnd()) {
+        resolution = *cached;
+    } else {
+        QList<OverloadResolutionCandidate> candidates;
+
+        const QMetaObject *mo = object->metaObject();
+        for (int i = 0; i < mo->methodCount(); ++i) {
+            QMetaMethod method = mo->method(i);
+            if (method.name() != methodName || method.parameterCount() != args.count()
+                    || method.access() != QMetaMethod::Public
+                    || (method.methodType() != QMetaMethod::Method
+                            && method.methodType() != QMetaMethod::Slot))
+            {
+                // Not a candidate
+                continue;
+            }
+
+            candidates.append({method, methodOverloadBadness(method, args, transport)});
         }
 
-        candidates.append({method, methodOverloadBadness(method, args)});
+        if (!candidates.isEmpty()) {
+            std::sort(candidates.begin(), candidates.end());
+            resolution.method = candidates.first().method;
+            resolution.ambiguous = candidates.size() > 1
+                    && candidates[0].badness == candidates[1].badness;
+        }
+        // only cache methods that exist, the cache is cleared once it is full
+        if (!isDynamic && resolution.method.isValid()) {
+            if (overloadResolutions.size() >= MaxOverloadResolutions)
+                overloadResolutions.clear();
+            overloadResolutions.insert(key, resolution);
+        }
     }
 
-    if (candidates.isEmpty()) {
+    if (!resolution.method.isValid()) {
         qWarning() << "No candidates found for" << methodName << "with" << args.size()
                    << "arguments on object" << object << '.';
         return QJsonValue();
     }
 
-    std::sort(candidates.begin(), candidates.end());
-    if (candidates.size() > 1 && candidates[0].badness == candidates[1].badness) {
+    if (resolution.ambiguous) {
         qWarning().nospace() << "Ambiguous overloads for method " << methodName << ". Choosing "
-                             << candidates.first().method.methodSignature();
+                             << resolution.method.methodSignature();
 
     }
 
-    return invokeMethod_helper(object, candidates.first().method, args);
+    return invokeMethod_helper(object, resolution.method, args, transport);
 }
 
-void QMetaObjectPublisher::setProperty(QObject *object, const int propertyIndex, const QJsonValue &value)
+void QMetaObjectPublisher::connectToSignal(QObject *object, int signalIndex,
+                                           QWebChannelAbstractTransport *transport)
+{
+    const QMetaMethod signal = object->metaObject()->method(signalIndex);
+    if (signal.methodType() != QMetaMethod::Signal) {
+        qWarning() << "Cannot connect to invalid signal" << signalIndex << "of object" << object
+                   << '.';
+        return;
+    }
+    signalHandlerFor(object)->connectTo(object, signalIndex);
+    ++signalSubscriptions[object][signalIndex][transport];
+}
+
+void QMetaObjectPublisher::disconnectFromSignal(QObject *object, int signalIndex,
+                                                QWebChannelAbstractTransport *transport)
+{
+    auto objectIt = signalSubscriptions.find(object);
+    if (objectIt == signalSubscriptions.end())
+        return;
+    auto signalIt = objectIt.value().find(signalIndex);
+    if (signalIt == objectIt.value().end())
+        return;
+    auto transportIt = signalIt.value().find(transport);
+    if (transportIt == signalIt.value().end())
+        return;
+
+    signalHandlerFor(object)->disconnectFrom(object, signalIndex);
+    if (--transportIt.value() == 0) {
+        signalIt.value().erase(transportIt);
+        if (signalIt.value().isEmpty()) {
+            objectIt.value().erase(signalIt);
+            if (objectIt.value().isEmpty())
+                signalSubscriptions.erase(objectIt);
+        }
+    }
+}
+
+void QMetaObjectPublisher::observeProperties(QObject *object, const QJsonArray &propertyIndices,
+                                             bool observe, QWebChannelAbstractTransport *transport)
+{
+    if (!hasCapability(transport, PropertyInterestCapability)) {
+        qWarning() << "Cannot observe properties of" << object
+                   << "for a client that did not negotiate property interest.";
+        return;
+    }
+
+    const QMetaObject *metaObject = object->metaObject();
+    const QString objectId = registeredObjectIds.value(object);
+    auto &observedByClient = transportState[transport].observedProperties;
+    QBitArray &observed = observedByClient[object];
+    observed.resize(metaObject->propertyCount());
+
+    QBitArray recipients;
+    insertTransport(recipients, transportIndex(transport));
+
+    ObjectUpdate update;
+    deferClassInfoSent = true;
+    deferredClassInfo = false;
+    for (const QJsonValue &value : propertyIndices) {
+        const int propertyIndex = value.toInt(-1);
+        if (propertyIndex < 0 || propertyIndex >= observed.size()) {
+            qWarning() << "Cannot observe invalid property" << value << "of object" << object;
+            continue;
+        }
+        if (observed.testBit(propertyIndex) == observe)
+            continue;
+        observed.setBit(propertyIndex, observe);
+        if (observe) {
+            const QMetaProperty property = metaObject->property(propertyIndex);
+            update.properties.append(
+                    { propertyIndex, wrapResult(property.read(object), nullptr, objectId,
+                                                recipients) });
+        }
+    }
+    deferClassInfoSent = false;
+    if (observed.count(true) == 0)
+        observedByClient.remove(object);
+
+    if (update.properties.isEmpty())
+        return;
+
+    const bool usesHandles = hasCapability(transport, ObjectHandlesCapability);
+    if (usesHandles) {
+        for (auto &property : update.properties)
+            property.second = addObjectHandles(property.second);
+    }
+
+    QJsonObject message;
+    message[KEY_TYPE] = TypePropertyUpdate;
+    message[KEY_DATA] = QJsonArray{ createObjectUpdate(
+            objectAddress(object, objectId, usesHandles), update,
+            hasCapability(transport, CompactUpdatesCapability)) };
+    enqueueMessage(message, transport, deferredClassInfo);
+    sendEnqueuedPropertyUpdates(transport);
+}
+
+void QMetaObjectPublisher::setProperty(QObject *object, const int propertyIndex,
+                                       const QJsonValue &value,
+                                       QWebChannelAbstractTransport *transport)
 {
     QMetaProperty property = object->metaObject()->property(propertyIndex);
     if (!property.isValid()) {
         qWarning() << "Cannot set unknown property" << propertyIndex << "of object" << object;
-    } else if (!property.write(object, toVariant(value, property.userType()))) {
+    } else if (const QVariant argument = toArgument(value, property.metaType(), transport);
+               !argument.isValid() || !property.write(object, argument)) {
         qWarning() << "Could not write value " << value << "to property" << property.name() << "of object" << object;
     }
 }
 
-void QMetaObjectPublisher::signalEmitted(const QObject *object, const int signalIndex, const QVariantList &arguments)
+void QMetaObjectPublisher::signalEmitted(const QObject *object, const int signalIndex, const SignalArguments &arguments)
 {
     if (!webChannel || webChannel->d_func()->transports.isEmpty()) {
         if (signalIndex == s_destroyedSignalIndex)
             objectDestroyed(object);
         return;
     }
-    if (!signalToPropertyMap.value(object).contains(signalIndex)) {
-        QJsonObject message;
-        const QString &objectName = registeredObjectIds.value(object);
-        Q_ASSERT(!objectName.isEmpty());
-        message[KEY_OBJECT] = objectName;
-        message[KEY_SIGNAL] = signalIndex;
-        if (!arguments.isEmpty()) {
-            message[KEY_ARGS] = wrapList(arguments, nullptr, objectName);
-        }
-        message[KEY_TYPE] = TypeSignal;
-
-        // if the object is wrapped, just send the response to clients which know this object
-        if (wrappedObjects.contains(objectName)) {
-            for (QWebChannelAbstractTransport *transport : wrappedObjects.value(objectName).transports) {
-                transport->sendMessage(message);
+    const QBitArray *notifiedProperties = nullptr;
+    if (const auto objectSignals = signalToPropertyMap.constFind(object);
+        objectSignals != signalToPropertyMap.constEnd()) {
+        const auto signal = objectSignals->constFind(signalIndex);
+        if (signal != objectSignals->constEnd())
+            notifiedProperties = &signal.value();
+    }
+    if (!notifiedProperties) {
+        // the destroyed signal is sent to all clients which know the object, other signals only
+        // to the clients which connected to them
+        const bool isDestroyedSignal = signalIndex == s_destroyedSignalIndex;
+        QList<QWebChannelAbstractTransport *> subscribers;
+        if (!isDestroyedSignal) {
+            const auto subscriptions = signalSubscriptions.constFind(object);
+            if (subscriptions != signalSubscriptions.constEnd()) {
+                const auto signalSubscribers = subscriptions->constFind(signalIndex);
+                if (signalSubscribers != subscriptions->constEnd())
+                    subscribers = signalSubscribers->keys();
+            }
+        }
+
+        if (isDestroyedSignal || !subscribers.isEmpty()) {
+            QJsonObject message;
+            const QString &objectName = registeredObjectIds.value(object);
+            Q_ASSERT(!objectName.isEmpty());
+            message[KEY_OBJECT] = objectName;
+            message[KEY_SIGNAL] = signalIndex;
+            message[KEY_TYPE] = TypeSignal;
+
+            QList<QWebChannelAbstractTransport *> recipients;
+            if (!isDestroyedSignal) {
+                recipients = subscribers;
+            } else if (const auto wrapped = wrappedObjects.constFind(objectName);
+                       wrapped != wrappedObjects.constEnd()) {
+                // if the object is wrapped, just send the response to clients which know this object
+                recipients = transportsInSet(wrapped->transports);
+            } else {
+                recipients = webChannel->d_func()->transports;
+            }
+
+            if (!arguments.isEmpty()) {
+                QBitArray recipientIndices;
+                for (auto *transport : std::as_const(recipients))
+                    insertTransport(recipientIndices, transportIndex(transport));
+                message[KEY_ARGS] = wrapArguments(arguments, objectName, recipientIndices);
+            }
+
+            // clients that negotiated handles address the object by its handle
+            QList<QWebChannelAbstractTransport *> handleRecipients;
+            recipients.removeIf([&](QWebChannelAbstractTransport *transport) {
+                if (!hasCapability(transport, ObjectHandlesCapability))
+                    return false;
+                handleRecipients.append(transport);
+                return true;
+            });
+            if (!recipients.isEmpty())
+                sendMessage(message, recipients);
+            if (!handleRecipients.isEmpty()) {
+                message[KEY_OBJECT] = objectHandle(object);
+                if (message.contains(KEY_ARGS))
+                    message[KEY_ARGS] = addObjectHandles(message.value(KEY_ARGS));
+                sendMessage(message, handleRecipients);
             }
-        } else {
-            broadcastMessage(message);
         }
 
-        if (signalIndex == s_destroyedSignalIndex) {
+        if (isDestroyedSignal) {
             objectDestroyed(object);
         }
-    } else {
-        auto &propertyUpdate = pendingPropertyUpdates[object];
-        propertyUpdate.signalMap[signalIndex] = arguments;
+    } else if (PropertyUpdate *update = pendingPropertyUpdate(object)) {
+        update->properties |= *notifiedProperties;
+        // only the arguments of the last emission of a signal are sent
+        auto signal = std::find_if(update->signalArguments.begin(), update->signalArguments.end(),
+                                   [&](const auto &signal) { return signal.first == signalIndex; });
+        if (signal != update->signalArguments.end())
+            signal->second = arguments.toJsonArray();
+        else
+            update->signalArguments.append({ signalIndex, arguments.toJsonArray() });
         startPropertyUpdateTimer();
     }
 }
 
 void QMetaObjectPublisher::propertyValueChanged(const QObject *object, const int propertyIndex)
 {
-    pendingPropertyUpdates[object].plainProperties.insert(propertyIndex);
-    startPropertyUpdateTimer();
+    if (PropertyUpdate *update = pendingPropertyUpdate(object)) {
+        if (propertyIndex >= update->properties.size())
+            update->properties.resize(object->metaObject()->propertyCount());
+        update->properties.setBit(propertyIndex);
+        startPropertyUpdateTimer();
+    }
+}
+
+QMetaObjectPublisher::PropertyUpdate *
+QMetaObjectPublisher::pendingPropertyUpdate(const QObject *object)
+{
+    const qint64 handle = objectHandle(object);
+    if (handle < 0)
+        return nullptr;
+    const qsizetype slot = handle & HandleSlotMask;
+    if (slot >= pendingPropertyUpdates.size())
+        pendingPropertyUpdates.resize(slot + 1);
+    PropertyUpdate &update = pendingPropertyUpdates[slot];
+    if (!update.isPending) {
+        update.isPending = true;
+        dirtyObjectSlots.append(slot);
+    }
+    return &update;
 }
 
 void QMetaObjectPublisher::startPropertyUpdateTimer(bool forceRestart)
@@ -722,16 +1670,44 @@ void QMetaObjectPublisher::objectDestroyed(const QObject *object)
         signalHandlerFor(object)->remove(object);
         signalToPropertyMap.remove(object);
     }
-    pendingPropertyUpdates.remove(object);
+    signalSubscriptions.remove(object);
+    // drop the pending updates before the slot of the object can be reused
+    if (const qint64 handle = objectHandle(object); handle >= 0) {
+        const qsizetype slot = handle & HandleSlotMask;
+        if (slot < pendingPropertyUpdates.size() && pendingPropertyUpdates.at(slot).isPending) {
+            pendingPropertyUpdates[slot] = PropertyUpdate();
+            dirtyObjectSlots.removeOne(slot);
+        }
+    }
+    releaseHandle(object);
+    for (auto &state : transportState)
+        state.observedProperties.remove(object);
     propertyObservers.erase(object);
 }
 
-QObject *QMetaObjectPublisher::unwrapObject(const QString &objectId) const
+QObject *QMetaObjectPublisher::findObject(const QJsonValue &objectId) const
+{
+    if (objectId.isDouble())
+        return objectForHandle(objectId.toInteger(-1));
+    const QString id = objectId.toString();
+    if (QObject *object = registeredObjects.value(id))
+        return object;
+    return wrappedObjects.value(id).object;
+}
+
+QObject *QMetaObjectPublisher::unwrapObject(const QString &objectId,
+                                            QWebChannelAbstractTransport *transport) const
 {
     if (!objectId.isEmpty()) {
         ObjectInfo objectInfo = wrappedObjects.value(objectId);
-        if (objectInfo.object)
+        if (objectInfo.object) {
+            // sequential ids are easily guessed, so only accept objects the client knows
+            if (transport && !isKnownTo(objectInfo.object, transport)) {
+                qWarning() << "Refusing to unwrap object unknown to transport" << objectId;
+                return nullptr;
+            }
             return objectInfo.object;
+        }
         QObject *object = registeredObjects.value(objectId);
         if (object)
             return object;
@@ -741,54 +1717,218 @@ QObject *QMetaObjectPublisher::unwrapObject(const QString &objectId) const
     return nullptr;
 }
 
-QVariant QMetaObjectPublisher::unwrapMap(QVariantMap map) const
+QObject *QMetaObjectPublisher::unwrapObject(const QJsonValue &objectId,
+                                            QWebChannelAbstractTransport *transport) const
+{
+    if (!objectId.isDouble())
+        return unwrapObject(objectId.toString(), transport);
+
+    QObject *object = objectForHandle(objectId.toInteger(-1));
+    if (!object) {
+        qWarning() << "No object with handle" << objectId.toInteger(-1);
+    } else if (transport && !isKnownTo(object, transport)) {
+        // handles are easily guessed, so only accept those of objects the client knows
+        qWarning() << "Refusing to unwrap object unknown to transport" << objectId;
+        return nullptr;
+    }
+    return object;
+}
+
+qint64 QMetaObjectPublisher::objectHandle(const QObject *object) const
+{
+    return objectHandles.value(object, -1);
+}
+
+QObject *QMetaObjectPublisher::objectForHandle(qint64 handle) const
+{
+    if (handle < 0)
+        return nullptr;
+    const qsizetype slot = handle & HandleSlotMask;
+    const quint32 generation = quint32(handle >> HandleSlotBits);
+    if (slot >= objectSlots.size() || objectSlots.at(slot).generation != generation)
+        return nullptr;
+    return objectSlots.at(slot).object;
+}
+
+bool QMetaObjectPublisher::isKnownTo(const QObject *object,
+                                     QWebChannelAbstractTransport *transport) const
+{
+    const QString id = registeredObjectIds.value(object);
+    if (registeredObjects.value(id) == object)
+        return true;
+    const auto wrapped = wrappedObjects.constFind(id);
+    const auto state = transportState.constFind(transport);
+    return wrapped != wrappedObjects.constEnd() && state != transportState.constEnd()
+            && state->index >= 0 && containsTransport(wrapped->transports, state->index);
+}
+
+qint64 QMetaObjectPublisher::assignHandle(QObject *object)
+{
+    qsizetype slot;
+    if (!freeObjectSlots.isEmpty()) {
+        slot = freeObjectSlots.takeLast();
+    } else {
+        slot = objectSlots.size();
+        Q_ASSERT(slot <= HandleSlotMask);
+        objectSlots.append(ObjectSlot());
+    }
+    ObjectSlot &entry = objectSlots[slot];
+    entry.object = object;
+    const qint64 handle = (qint64(entry.generation) << HandleSlotBits) | slot;
+    objectHandles.insert(object, handle);
+    return handle;
+}
+
+void QMetaObjectPublisher::releaseHandle(const QObject *object)
+{
+    const auto found = objectHandles.constFind(object);
+    if (found == objectHandles.constEnd())
+        return;
+    const qsizetype slot = found.value() & HandleSlotMask;
+    objectHandles.erase(found);
+    ObjectSlot &entry = objectSlots[slot];
+    entry.object = nullptr;
+    entry.generation = (entry.generation + 1) & HandleGenerationMask;
+    freeObjectSlots.append(slot);
+}
+
+qsizetype QMetaObjectPublisher::transportIndex(QWebChannelAbstractTransport *transport)
+{
+    TransportState &state = transportState[transport];
+    if (state.index < 0) {
+        if (!freeTransportIndices.isEmpty()) {
+            state.index = freeTransportIndices.takeLast();
+            indexedTransports[state.index] = transport;
+        } else {
+            state.index = indexedTransports.size();
+            indexedTransports.append(transport);
+        }
+    }
+    return state.index;
+}
+
+QList<QWebChannelAbstractTransport *>
+QMetaObjectPublisher::transportsInSet(const QBitArray &transports) const
+{
+    QList<QWebChannelAbstractTransport *> result;
+    for (qsizetype index = 0; index < transports.size(); ++index) {
+        if (transports.testBit(index)) {
+            Q_ASSERT(indexedTransports.at(index));
+            result.append(indexedTransports.at(index));
+        }
+    }
+    return result;
+}
+
+QString QMetaObjectPublisher::createWrappedObjectId()
+{
+    if (wrappedObjectIdFormat == QWebChannel::UuidIds)
+        return QUuid::createUuid().toString();
+
+    QString id;
+    do {
+        id = QLatin1StringView("{wrapped-") + QString::number(nextWrappedObjectId++) + u'}';
+    } while (registeredObjects.contains(id) || wrappedObjects.contains(id));
+    return id;
+}
+
+void QMetaObjectPublisher::setClassInfoSent(const QString &id, const QBitArray &receivers)
+{
+    auto info = wrappedObjects.find(id);
+    if (info == wrappedObjects.end())
+        return;
+    for (qsizetype index = 0; index < receivers.size(); ++index) {
+        if (!receivers.testBit(index))
+            continue;
+        Q_ASSERT(indexedTransports.at(index));
+        if (!containsTransport(info->transports, index)) {
+            insertTransport(info->transports, index);
+            transportedWrappedObjects.insert(indexedTransports.at(index), id);
+        }
+        if (deferClassInfoSent)
+            deferredClassInfo = true;
+        else
+            insertTransport(info->classInfoSent, index);
+    }
+}
+
+void QMetaObjectPublisher::classInfoDelivered(const QJsonValue &value, qsizetype index)
+{
+    Q_ASSERT(!deferClassInfoSent);
+    if (index < 0)
+        return;
+    if (value.isArray()) {
+        const QJsonArray array = value.toArray();
+        for (const QJsonValue &element : array)
+            classInfoDelivered(element, index);
+        return;
+    }
+    if (!value.isObject())
+        return;
+
+    const QJsonObject object = value.toObject();
+    if (object.value(KEY_QOBJECT).toBool() && object.contains(KEY_DATA)) {
+        QBitArray receivers;
+        insertTransport(receivers, index);
+        setClassInfoSent(object.value(KEY_ID).toString(), receivers);
+    }
+    // the class information and other values may describe further objects
+    for (const QJsonValue &member : object)
+        classInfoDelivered(member, index);
+}
+
+QVariant QMetaObjectPublisher::unwrapMap(QVariantMap map,
+                                         QWebChannelAbstractTransport *transport) const
 {
     const auto qobj = map.value(KEY_QOBJECT).toBool();
-    const auto id = qobj ? map.value(KEY_ID).toString() : QString();
+    const auto id = qobj ? QJsonValue::fromVariant(map.value(KEY_ID)) : QJsonValue();
 
-    if (!id.isEmpty()) // it's probably a QObject
-        return QVariant::fromValue(unwrapObject(id));
+    if (id.isDouble() || !id.toString().isEmpty()) // it's probably a QObject
+        return QVariant::fromValue(unwrapObject(id, transport));
 
     // it's probably just a normal JS object, continue searching for objects
     // that look like QObject*
     for (auto &value : map)
-        value = unwrapVariant(value);
+        value = unwrapVariant(value, transport);
 
     return map;
 }
 
-QVariant QMetaObjectPublisher::unwrapList(QVariantList list) const
+QVariant QMetaObjectPublisher::unwrapList(QVariantList list,
+                                          QWebChannelAbstractTransport *transport) const
 {
     for (auto &value : list)
-        value = unwrapVariant(value);
+        value = unwrapVariant(value, transport);
 
     return list;
 }
 
-QVariant QMetaObjectPublisher::unwrapVariant(const QVariant &value) const
+QVariant QMetaObjectPublisher::unwrapVariant(const QVariant &value,
+                                             QWebChannelAbstractTransport *transport) const
 {
     switch (value.metaType().id())
     {
         case QMetaType::QVariantList:
-            return unwrapList(value.toList());
+            return unwrapList(value.toList(), transport);
         case QMetaType::QVariantMap:
-            return unwrapMap(value.toMap());
+            return unwrapMap(value.toMap(), transport);
         default:
             break;
     }
     return value;
 }
 
-QVariant QMetaObjectPublisher::toVariant(const QJsonValue &value, int targetType) const
+QVariant QMetaObjectPublisher::toVariant(const QJsonValue &value, int targetType,
+                                         QWebChannelAbstractTransport *transport) const
 {
     QMetaType target(targetType);
 
     if (target.flags() & QMetaType::PointerToQObject) {
-        QObject *unwrappedObject = unwrapObject(value.toObject()[KEY_ID].toString());
+        QObject *unwrappedObject = unwrapObject(value.toObject()[KEY_ID], transport);
         if (unwrappedObject == nullptr)
             qWarning() << "Cannot not convert non-object argument" << value << "to QObject*.";
         return QVariant::fromValue(unwrappedObject);
-    } else if (isQFlagsType(targetType)) {
+    } else if (classifyType(target).category == FlagsType) {
         int flagsValue = value.toInt();
         return QVariant(target, reinterpret_cast<const void*>(&flagsValue));
     }
@@ -804,10 +1944,20 @@ QVariant QMetaObjectPublisher::toVariant(const QJsonValue &value, int targetType
         else
             qWarning() << "Could not convert argument" << value << "to target type" << target.name() << '.';
     }
-    return unwrapVariant(variant);
+    return unwrapVariant(variant, transport);
+}
+
+QVariant QMetaObjectPublisher::toArgument(const QJsonValue &value, QMetaType type,
+                                          QWebChannelAbstractTransport *transport) const
+{
+    QVariant argument(type);
+    if (!argumentConverter(type)(*this, transport, value, type, argument.data()))
+        return QVariant();
+    return argument;
 }
 
-int QMetaObjectPublisher::conversionScore(const QJsonValue &value, int targetType) const
+int QMetaObjectPublisher::conversionScore(const QJsonValue &value, int targetType,
+                                          QWebChannelAbstractTransport *transport) const
 {
     QMetaType target(targetType);
     if (targetType == QMetaType::QJsonValue) {
@@ -826,7 +1976,7 @@ int QMetaObjectPublisher::conversionScore(const QJsonValue &value, int targetTyp
         if (object[KEY_ID].isUndefined())
             return IncompatibleScore;
 
-        QObject *unwrappedObject = unwrapObject(object[KEY_ID].toString());
+        QObject *unwrappedObject = unwrapObject(object[KEY_ID], transport);
         return unwrappedObject != nullptr ? PerfectMatchScore : IncompatibleScore;
     } else if (targetType == QMetaType::QVariant) {
         return VariantScore;
@@ -850,33 +2000,106 @@ int QMetaObjectPublisher::conversionScore(const QJsonValue &value, int targetTyp
     return IncompatibleScore;
 }
 
-int QMetaObjectPublisher::methodOverloadBadness(const QMetaMethod &method, const QJsonArray &args) const
+int QMetaObjectPublisher::methodOverloadBadness(const QMetaMethod &method, const QJsonArray &args,
+                                                QWebChannelAbstractTransport *transport) const
 {
     int badness = PerfectMatchScore;
     for (int i = 0; i < args.size(); ++i) {
-        badness += conversionScore(args[i], method.parameterType(i));
+        badness += conversionScore(args[i], method.parameterType(i), transport);
     }
     return badness;
 }
 
+QByteArray QMetaObjectPublisher::argumentKinds(const QJsonArray &args,
+                                               QWebChannelAbstractTransport *transport) const
+{
+    QByteArray kinds;
+    kinds.reserve(args.size());
+    for (const QJsonValue &value : args) {
+        switch (value.type()) {
+        case QJsonValue::Null:
+            kinds += 'n';
+            break;
+        case QJsonValue::Bool:
+            kinds += 'b';
+            break;
+        case QJsonValue::Double:
+            // integers and doubles convert differently to non-numeric types
+            kinds += value.toVariant().userType() == QMetaType::Double ? 'd' : 'i';
+            break;
+        case QJsonValue::String:
+            kinds += 's';
+            break;
+        case QJsonValue::Array:
+            kinds += 'a';
+            break;
+        case QJsonValue::Object: {
+            // objects only match QObject* parameters if they refer to a known object, other
+            // objects may have an id as well, so look it up without warnings
+            const QJsonValue id = value.toObject().value(KEY_ID);
+            if (id.isUndefined()) {
+                kinds += 'o';
+            } else {
+                const QObject *object = findObject(id);
+                kinds += object && (!transport || isKnownTo(object, transport)) ? 'q' : 'u';
+            }
+            break;
+        }
+        case QJsonValue::Undefined:
+            kinds += 'x';
+            break;
+        }
+    }
+    return kinds;
+}
+
 void QMetaObjectPublisher::transportRemoved(QWebChannelAbstractTransport *transport)
 {
     auto it = transportedWrappedObjects.find(transport);
     // It is not allowed to modify a container while iterating over it. So save
     // objects which should be removed and call objectDestroyed() on them later.
     QList<QObject *> objectsForDeletion;
+    const qsizetype index = transportState.value(transport).index;
     while (it != transportedWrappedObjects.end() && it.key() == transport) {
-        if (wrappedObjects.contains(it.value())) {
-            QList<QWebChannelAbstractTransport *> &transports = wrappedObjects[it.value()].transports;
-            transports.removeOne(transport);
-            if (transports.isEmpty())
-                objectsForDeletion.append(wrappedObjects[it.value()].object);
+        auto wrapped = wrappedObjects.find(it.value());
+        if (wrapped != wrappedObjects.end() && index >= 0) {
+            QBitArray &transports = wrapped->transports;
+            if (containsTransport(transports, index))
+                transports.clearBit(index);
+            if (containsTransport(wrapped->classInfoSent, index))
+                wrapped->classInfoSent.clearBit(index);
+            if (transports.count(true) == 0)
+                objectsForDeletion.append(wrapped->object);
         }
 
         it++;
     }
 
     transportedWrappedObjects.remove(transport);
+    transportState.remove(transport);
+    // the index is only reused once no object refers to the transport anymore
+    if (index >= 0) {
+        indexedTransports[index] = nullptr;
+        freeTransportIndices.append(index);
+    }
+
+    // drop the signal connections of the client
+    for (auto objectIt = signalSubscriptions.begin(); objectIt != signalSubscriptions.end();) {
+        auto &objectSignals = objectIt.value();
+        for (auto signalIt = objectSignals.begin(); signalIt != objectSignals.end();) {
+            const int connections = signalIt.value().take(transport);
+            for (int i = 0; i < connections; ++i)
+                signalHandlerFor(objectIt.key())->disconnectFrom(objectIt.key(), signalIt.key());
+            if (signalIt.value().isEmpty())
+                signalIt = objectSignals.erase(signalIt);
+            else
+                ++signalIt;
+        }
+        if (objectSignals.isEmpty())
+            objectIt = signalSubscriptions.erase(objectIt);
+        else
+            ++objectIt;
+    }
 
     for (QObject *obj : std::as_const(objectsForDeletion))
         objectDestroyed(obj);
@@ -886,54 +2109,78 @@ void QMetaObjectPublisher::transportRemoved(QWebChannelAbstractTransport *transp
 //       in such a case, we need to ensure that the property is registered to
 //       the target transports of the parentObjectId
 QJsonValue QMetaObjectPublisher::wrapResult(const QVariant &result, QWebChannelAbstractTransport *transport,
-                                            const QString &parentObjectId)
+                                            const QString &parentObjectId,
+                                            const QBitArray &recipients)
 {
-    if (QObject *object = result.value<QObject *>()) {
+    const TypeClassification classification = classifyType(result.metaType());
+    if (QObject *object = classification.mayBeObject ? result.value<QObject *>() : nullptr) {
         QString id = registeredObjectIds.value(object);
+        QBitArray receivers = recipients;
+        if (transport) {
+            receivers.clear();
+            insertTransport(receivers, transportIndex(transport));
+        }
 
         QJsonObject classInfo;
         if (id.isEmpty()) {
             // neither registered, nor wrapped, do so now
-            id = QUuid::createUuid().toString();
+            id = createWrappedObjectId();
             // store ID before the call to classInfoForObject()
             // in case of self-contained objects it avoids
             // infinite loops
             registeredObjectIds[object] = id;
+            assignHandle(object);
 
             classInfo = classInfoForObject(object, transport);
 
             ObjectInfo oi(object);
             if (transport) {
-                oi.transports.append(transport);
+                insertTransport(oi.transports, transportIndex(transport));
                 transportedWrappedObjects.insert(transport, id);
             } else {
                 // use the transports from the parent object
-                oi.transports = wrappedObjects.value(parentObjectId).transports;
+                const auto parent = wrappedObjects.constFind(parentObjectId);
+                if (parent != wrappedObjects.constEnd()) {
+                    oi.transports = parent->transports;
+                    for (auto transport : transportsInSet(oi.transports))
+                        transportedWrappedObjects.insert(transport, id);
+                }
                 // or fallback to all transports if the parent is not wrapped
-                if (oi.transports.isEmpty())
-                    oi.transports = webChannel->d_func()->transports;
-
-                for (auto transport : std::as_const(oi.transports)) {
-                    transportedWrappedObjects.insert(transport, id);
+                if (oi.transports.count(true) == 0) {
+                    for (auto transport : std::as_const(webChannel->d_func()->transports)) {
+                        insertTransport(oi.transports, transportIndex(transport));
+                        transportedWrappedObjects.insert(transport, id);
+                    }
                 }
             }
             wrappedObjects.insert(id, oi);
+            setClassInfoSent(id, receivers);
 
-            initializePropertyUpdates(object, classInfo);
+            initializePropertyUpdates(object, classDescriptor(object));
         } else {
             auto oi = wrappedObjects.find(id);
             if (oi != wrappedObjects.end() && !oi->isBeingWrapped) {
                 Q_ASSERT(object == oi->object);
                 // check if this transport is already assigned to the object
-                if (transport && !oi->transports.contains(transport)) {
-                    oi->transports.append(transport);
-                    transportedWrappedObjects.insert(transport, id);
+                if (transport) {
+                    const qsizetype index = transportIndex(transport);
+                    if (!containsTransport(oi->transports, index)) {
+                        insertTransport(oi->transports, index);
+                        transportedWrappedObjects.insert(transport, id);
+                    }
+                }
+                // only send the class information to clients which do not have it yet
+                if (receivers.count(true) == 0
+                    || !containsTransports(oi->classInfoSent, receivers)) {
+                    // QTBUG-84007: Block infinite recursion for self-contained objects
+                    // which have already been wrapped
+                    oi->isBeingWrapped = true;
+                    classInfo = classInfoForObject(object, transport);
+                    // wrapping the properties may have inserted other objects
+                    oi = wrappedObjects.find(id);
+                    oi->isBeingWrapped = false;
+                    setClassInfoSent(id, receivers);
                 }
-                // QTBUG-84007: Block infinite recursion for self-contained objects
-                // which have already been wrapped
-                oi->isBeingWrapped = true;
-                classInfo = classInfoForObject(object, transport);
-                oi->isBeingWrapped = false;
             }
         }
 
@@ -944,61 +2191,194 @@ QJsonValue QMetaObjectPublisher::wrapResult(const QVariant &result, QWebChannelA
             objectInfo[KEY_DATA] = classInfo;
 
         return objectInfo;
-    } else if (result.metaType().flags().testFlag(QMetaType::IsEnumeration)) {
+    }
+
+    switch (classification.category) {
+    case EnumType:
         return result.toInt();
-    } else if (isQFlagsType(result.userType())) {
+    case FlagsType:
         return *reinterpret_cast<const int*>(result.constData());
+    case JSValueType:
 #ifndef QT_NO_JSVALUE
-    } else if (result.canConvert<QJSValue>()) {
         // Workaround for keeping QJSValues from QVariant.
         // Calling QJSValue::toVariant() converts JS-objects/arrays to QVariantMap/List
         // instead of stashing a QJSValue itself into a variant.
         // TODO: Improve QJSValue-QJsonValue conversion in Qt.
-        return wrapResult(result.value<QJSValue>().toVariant(), transport, parentObjectId);
+        return wrapResult(result.value<QJSValue>().toVariant(), transport, parentObjectId,
+                          recipients);
 #endif
-    } else if (result.metaType().id() == QMetaType::QString ||
-               result.metaType().id() == QMetaType::QByteArray) {
-        // avoid conversion to QVariantList
-    } else if (result.canConvert<QVariantList>()) {
+        break;
+    case ListType: {
+        if (const PackedArrayType *packed = packedArrayType(result.metaType());
+            packed && packsArrays(transport, recipients)) {
+            return QJsonObject{
+                { KEY_PACKED, packed->name },
+                { KEY_DATA, packed->pack(result.constData()) },
+            };
+        }
+        // containers of plain values are read through their QMetaSequence directly, which
+        // never goes through the QVariant based QSequentialIterable nor wraps any elements
+        if (classification.elementToJson) {
+            return sequenceToJson(classification.sequence, result.constData(),
+                                  classification.elementToJson);
+        }
         // recurse and potentially wrap contents of the array
         // *don't* use result.toList() as that *only* works for QVariantList and QStringList!
-        // Also, don't use QSequentialIterable (yet), since that seems to trigger QTBUG-42016
-        // in certain cases.
+        // Also, don't use QSequentialIterable (yet) for the remaining containers, e.g. of
+        // QObject pointers or variants, since that seems to trigger QTBUG-42016 in certain cases.
         // additionally, when there's a direct converter to QVariantList, use that one via convert
         // but recover when conversion fails and fall back to the .value<QVariantList> conversion
         // see also: https://bugreports.qt.io/browse/QTBUG-80751
         auto list = result;
         if (!list.convert(QMetaType::fromType<QVariantList>()))
             list = result;
-        return wrapList(list.value<QVariantList>(), transport);
-    } else if (result.canConvert<QVariantMap>()) {
+        return wrapList(list.value<QVariantList>(), transport, parentObjectId, recipients);
+    }
+    case MapType: {
+        if (classification.elementToJson) {
+            return associationToJson(classification.association, result.constData(),
+                                     classification.elementToJson);
+        }
         // recurse and potentially wrap contents of the map
         auto map = result;
         if (!map.convert(QMetaType::fromType<QVariantMap>()))
             map = result;
-        return wrapMap(map.value<QVariantMap>(), transport);
-    } else if (auto v = result; v.convert(QMetaType::fromType<QJsonValue>())) {
+        return wrapMap(map.value<QVariantMap>(), transport, parentObjectId, recipients);
+    }
+    case JsonConvertibleType:
         // Support custom converters to QJsonValue
-        return v.value<QJsonValue>();
+        if (auto v = result; v.convert(QMetaType::fromType<QJsonValue>()))
+            return v.value<QJsonValue>();
+        break;
+    case PlainType:
+        break;
     }
 
     return QJsonValue::fromVariant(result);
 }
 
-QJsonArray QMetaObjectPublisher::wrapList(const QVariantList &list, QWebChannelAbstractTransport *transport, const QString &parentObjectId)
+QMetaObjectPublisher::TypeClassification QMetaObjectPublisher::classifyType(QMetaType type) const
+{
+    const auto it = typeClassifications.constFind(type.id());
+    if (it != typeClassifications.constEnd())
+        return *it;
+
+    // the same checks as wrapResult did on every value, in the same order
+    TypeClassification classification;
+    classification.mayBeObject = QMetaType::canConvert(type, QMetaType::fromType<QObject *>());
+    if (type.flags().testFlag(QMetaType::IsEnumeration)) {
+        classification.category = EnumType;
+    } else if (isQFlagsType(type.id())) {
+        classification.category = FlagsType;
+#ifndef QT_NO_JSVALUE
+    } else if (QMetaType::canConvert(type, QMetaType::fromType<QJSValue>())) {
+        classification.category = JSValueType;
+#endif
+    } else if (type.id() == QMetaType::QString || type.id() == QMetaType::QByteArray) {
+        // avoid conversion to QVariantList
+        classification.category = PlainType;
+    } else if (QMetaType::canConvert(type, QMetaType::fromType<QVariantList>())) {
+        classification.category = ListType;
+    } else if (QMetaType::canConvert(type, QMetaType::fromType<QVariantMap>())) {
+        classification.category = MapType;
+    } else if (QMetaType::canConvert(type, QMetaType::fromType<QJsonValue>())) {
+        classification.category = JsonConvertibleType;
+    }
+
+    // containers of plain elements are iterated directly, which requires a view of the container
+    auto isPlainElement = [this](QMetaType elementType) {
+        const TypeClassification element = classifyType(elementType);
+        return !element.mayBeObject && element.category == PlainType;
+    };
+    if (classification.category == ListType) {
+        QVariant container(type);
+        QSequentialIterable iterable;
+        if (QMetaType::view(type, container.data(), QMetaType::fromType<QSequentialIterable>(),
+                            &iterable)) {
+            const QMetaSequence sequence = iterable.metaContainer();
+            if (sequence.hasConstIterator() && sequence.canGetValueAtConstIterator()
+                && isPlainElement(sequence.valueMetaType())) {
+                classification.elementToJson = elementConverter(sequence.valueMetaType());
+                classification.sequence = sequence;
+            }
+        }
+    } else if (classification.category == MapType) {
+        QVariant container(type);
+        QAssociativeIterable iterable;
+        if (QMetaType::view(type, container.data(), QMetaType::fromType<QAssociativeIterable>(),
+                            &iterable)) {
+            const QMetaAssociation association = iterable.metaContainer();
+            if (association.hasConstIterator() && association.canGetMappedAtConstIterator()
+                && association.keyMetaType() == QMetaType::fromType<QString>()
+                && isPlainElement(association.mappedMetaType())) {
+                classification.elementToJson = elementConverter(association.mappedMetaType());
+                classification.association = association;
+            }
+        }
+    }
+    typeClassifications.insert(type.id(), classification);
+    return classification;
+}
+
+QJsonArray QMetaObjectPublisher::wrapList(const QVariantList &list, QWebChannelAbstractTransport *transport, const QString &parentObjectId,
+                                          const QBitArray &recipients)
 {
     QJsonArray array;
     for (const QVariant &arg : list) {
-        array.append(wrapResult(arg, transport, parentObjectId));
+        array.append(wrapResult(arg, transport, parentObjectId, recipients));
+    }
+    return array;
+}
+
+QJsonValue QMetaObjectPublisher::addObjectHandles(const QJsonValue &value) const
+{
+    if (value.isArray()) {
+        QJsonArray array = value.toArray();
+        for (auto it = array.begin(), end = array.end(); it != end; ++it)
+            *it = addObjectHandles(*it);
+        return array;
+    }
+    if (!value.isObject())
+        return value;
+
+    QJsonObject object = value.toObject();
+    if (object.value(KEY_QOBJECT).toBool() && object.value(KEY_DATA).isObject()) {
+        // the class information may describe further objects
+        QJsonObject classInfo = addObjectHandles(object.value(KEY_DATA)).toObject();
+        const QString id = object.value(KEY_ID).toString();
+        QObject *described = registeredObjects.value(id);
+        if (!described)
+            described = wrappedObjects.value(id).object;
+        if (const qint64 handle = objectHandle(described); described && handle >= 0)
+            classInfo[KEY_HANDLE] = handle;
+        object[KEY_DATA] = classInfo;
+        return object;
+    }
+    for (auto it = object.begin(), end = object.end(); it != end; ++it)
+        *it = addObjectHandles(*it);
+    return object;
+}
+
+QJsonArray QMetaObjectPublisher::wrapArguments(const SignalArguments &arguments,
+                                               const QString &parentObjectId,
+                                               const QBitArray &recipients)
+{
+    QJsonArray array;
+    for (qsizetype i = 0; i < arguments.size(); ++i) {
+        if (arguments.hasJsonConverter(i))
+            array.append(arguments.toJson(i));
+        else
+            array.append(wrapResult(arguments.value(i), nullptr, parentObjectId, recipients));
     }
     return array;
 }
 
-QJsonObject QMetaObjectPublisher::wrapMap(const QVariantMap &map, QWebChannelAbstractTransport *transport, const QString &parentObjectId)
+QJsonObject QMetaObjectPublisher::wrapMap(const QVariantMap &map, QWebChannelAbstractTransport *transport, const QString &parentObjectId,
+                                          const QBitArray &recipients)
 {
     QJsonObject obj;
     for (QVariantMap::const_iterator i = map.begin(); i != map.end(); i++) {
-        obj.insert(i.key(), wrapResult(i.value(), transport, parentObjectId));
+        obj.insert(i.key(), wrapResult(i.value(), transport, parentObjectId, recipients));
     }
     return obj;
 }
@@ -1014,38 +2394,354 @@ void QMetaObjectPublisher::deleteWrappedObject(QObject *object) const
 
 void QMetaObjectPublisher::broadcastMessage(const QJsonObject &message) const
 {
-    if (webChannel->d_func()->transports.isEmpty()) {
-        return;
+    sendMessage(message, webChannel->d_func()->transports);
+}
+
+void QMetaObjectPublisher::sendMessage(const QJsonObject &message,
+                                       const QList<QWebChannelAbstractTransport *> &transports) const
+{
+    OutgoingMessage outgoing(message);
+    for (QWebChannelAbstractTransport *transport : transports)
+        deliverMessage(outgoing, transport);
+}
+
+const QByteArray &
+QMetaObjectPublisher::OutgoingMessage::encoded(QWebChannelAbstractTransport::MessageFormat format)
+{
+    merged();
+    if (format == QWebChannelAbstractTransport::CborFormat) {
+        if (cbor.isEmpty())
+            cbor = encodeCbor(message);
+        return cbor;
+    }
+    Q_ASSERT(format == QWebChannelAbstractTransport::JsonFormat);
+    if (json.isEmpty())
+        json = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    return json;
+}
+
+const QJsonObject &QMetaObjectPublisher::OutgoingMessage::merged()
+{
+    if (!laterUpdates.isEmpty()) {
+        laterUpdates.prepend(message);
+        message = mergePropertyUpdates(laterUpdates);
+        laterUpdates.clear();
+        json.clear();
+        cbor.clear();
+    }
+    return message;
+}
+
+QWebChannelAbstractTransport::MessageFormat
+QMetaObjectPublisher::messageFormat(QWebChannelAbstractTransport *transport) const
+{
+    const auto formats = encodedMessageFormats(transport);
+    if (formats & QWebChannelAbstractTransport::CborFormat
+        && hasCapability(transport, CborCapability)) {
+        return QWebChannelAbstractTransport::CborFormat;
+    }
+    if (formats & QWebChannelAbstractTransport::JsonFormat)
+        return QWebChannelAbstractTransport::JsonFormat;
+    return QWebChannelAbstractTransport::MessageFormat(0);
+}
+
+QWebChannelAbstractTransport::MessageFormats
+QMetaObjectPublisher::encodedMessageFormats(QWebChannelAbstractTransport *transport) const
+{
+    const auto formats = transport->supportedMessageFormats();
+    if (!formats || !encodedMessageSlot(transport).isValid())
+        return {};
+    return formats;
+}
+
+QMetaMethod QMetaObjectPublisher::encodedMessageSlot(QWebChannelAbstractTransport *transport) const
+{
+    const QMetaObject *metaObject = transport->metaObject();
+    // dynamic meta objects may be freed and their address reused, so they are not cached
+    const bool isDynamic = QObjectPrivate::get(transport)->metaObject;
+    if (!isDynamic) {
+        const auto found = encodedMessageSlots.constFind(metaObject);
+        if (found != encodedMessageSlots.constEnd())
+            return *found;
+    }
+
+    QMetaMethod slot;
+    for (int i = metaObject->methodCount() - 1; i >= 0; --i) {
+        const QMetaMethod method = metaObject->method(i);
+        if (method.methodType() == QMetaMethod::Slot && method.parameterCount() == 2
+            && method.name() == "sendEncodedMessage"
+            && method.parameterMetaType(0) == QMetaType::fromType<QByteArray>()
+            && method.parameterMetaType(1)
+                    == QMetaType::fromType<QWebChannelAbstractTransport::MessageFormat>()) {
+            slot = method;
+            break;
+        }
+    }
+    if (!slot.isValid()) {
+        qWarning() << "Transport" << transport << "supports pre-serialized messages, but has no"
+                   << "sendEncodedMessage(QByteArray, QWebChannelAbstractTransport::MessageFormat)"
+                   << "slot. Its messages are passed to sendMessage() instead.";
+    }
+    if (!isDynamic)
+        encodedMessageSlots.insert(metaObject, slot);
+    return slot;
+}
+
+bool QMetaObjectPublisher::hasCapability(QWebChannelAbstractTransport *transport,
+                                         ClientCapability capability) const
+{
+    auto found = transportState.constFind(transport);
+    return found != transportState.constEnd() && found.value().capabilities.testFlag(capability);
+}
+
+bool QMetaObjectPublisher::packsArrays(QWebChannelAbstractTransport *transport,
+                                       const QBitArray &recipients) const
+{
+    if (transport)
+        return hasCapability(transport, PackedArraysCapability);
+    if (recipients.count(true) == 0)
+        return false;
+    for (qsizetype index = 0; index < recipients.size(); ++index) {
+        if (recipients.testBit(index)
+            && !hasCapability(indexedTransports.at(index), PackedArraysCapability)) {
+            return false;
+        }
     }
+    return true;
+}
+
+int QMetaObjectPublisher::updateFormat(QWebChannelAbstractTransport *transport) const
+{
+    auto found = transportState.constFind(transport);
+    if (found == transportState.constEnd())
+        return 0;
+    int format = 0;
+    if (found.value().capabilities.testFlag(CompactUpdatesCapability))
+        format |= CompactUpdateFormat;
+    if (found.value().capabilities.testFlag(ObjectHandlesCapability))
+        format |= HandleUpdateFormat;
+    return format;
+}
+
+QJsonValue QMetaObjectPublisher::objectAddress(const QObject *object, const QString &objectId,
+                                               bool useHandle) const
+{
+    return useHandle ? QJsonValue(objectHandle(object)) : QJsonValue(objectId);
+}
+
+QBitArray QMetaObjectPublisher::observedProperties(QWebChannelAbstractTransport *transport,
+                                                  const QObject *object) const
+{
+    auto found = transportState.constFind(transport);
+    if (found == transportState.constEnd())
+        return QBitArray();
+    return found.value().observedProperties.value(object);
+}
+
+void QMetaObjectPublisher::deliverMessage(OutgoingMessage &message,
+                                          QWebChannelAbstractTransport *transport) const
+{
+    if (const auto format = messageFormat(transport))
+        encodedMessageSlot(transport).invoke(transport, Qt::DirectConnection,
+                                             message.encoded(format), format);
+    else
+        transport->sendMessage(message.merged());
+}
+
+QByteArray QMetaObjectPublisher::encodeCbor(const QJsonObject &message)
+{
+    QByteArray data;
+    QCborStreamWriter writer(&data);
+    writeCbor(writer, message);
+    return data;
+}
 
-    for (QWebChannelAbstractTransport *transport : webChannel->d_func()->transports) {
-        transport->sendMessage(message);
+ClientCapabilities
+QMetaObjectPublisher::negotiateCapabilities(const QJsonObject &requested,
+                                            QWebChannelAbstractTransport *transport) const
+{
+    ClientCapabilities capabilities;
+    for (const CapabilityName &entry : capabilityNames) {
+        if (requested.value(entry.name).toBool())
+            capabilities |= entry.capability;
     }
+    if (!(encodedMessageFormats(transport) & QWebChannelAbstractTransport::CborFormat))
+        capabilities &= ~ClientCapabilities(CborCapability);
+    return capabilities;
 }
 
-void QMetaObjectPublisher::enqueueBroadcastMessage(const QJsonObject &message)
+void QMetaObjectPublisher::enqueueBroadcastMessage(
+        const std::array<QJsonObject, UpdateFormatCount> &messages, bool carriesClassInfo)
 {
     if (webChannel->d_func()->transports.isEmpty()) {
         return;
     }
 
-    for (auto *transport : webChannel->d_func()->transports) {
-        auto &state = transportState[transport];
-        state.queuedMessages.append(message);
+    std::array<OutgoingMessage, UpdateFormatCount> outgoing;
+    for (int format = 0; format < UpdateFormatCount; ++format) {
+        outgoing[format] = OutgoingMessage(messages[format]);
+        outgoing[format].carriesClassInfo = carriesClassInfo;
+    }
+    for (auto *transport : std::as_const(webChannel->d_func()->transports)) {
+        // these get the updates filtered by their interest instead
+        if (hasCapability(transport, PropertyInterestCapability))
+            continue;
+        OutgoingMessage &queued = outgoing[updateFormat(transport)];
+        // serialize before queuing, so that all transports share the same buffers
+        if (const auto format = messageFormat(transport))
+            queued.encoded(format);
+        appendToQueue(queued, transport);
     }
 }
 
 void QMetaObjectPublisher::enqueueMessage(const QJsonObject &message,
-                                          QWebChannelAbstractTransport *transport)
+                                          QWebChannelAbstractTransport *transport,
+                                          bool carriesClassInfo)
+{
+    OutgoingMessage outgoing(message);
+    outgoing.carriesClassInfo = carriesClassInfo;
+    appendToQueue(outgoing, transport);
+}
+
+void QMetaObjectPublisher::appendToQueue(const OutgoingMessage &message,
+                                         QWebChannelAbstractTransport *transport)
 {
     auto &state = transportState[transport];
-    state.queuedMessages.append(message);
+    if (state.disconnecting)
+        return;
+    const QueueLimits limits = queueLimits(transport);
+    if (!state.queuedMessages.isEmpty() && isPropertyUpdate(state.queuedMessages.last().message)
+        && isPropertyUpdate(message.message)) {
+        // the client did not receive the previous update yet, so merge them to send it only
+        // the latest values once it catches up; the merge is deferred until the message is
+        // serialized, which only happens here while a byte limit applies
+        OutgoingMessage &last = state.queuedMessages.last();
+        state.queuedBytes -= queuedSize(last, transport, limits);
+        last.laterUpdates.append(message.message);
+        last.carriesClassInfo |= message.carriesClassInfo;
+        state.queuedBytes += queuedSize(last, transport, limits);
+    } else {
+        state.queuedMessages.append(message);
+        state.queuedBytes += queuedSize(state.queuedMessages.last(), transport, limits);
+    }
+    enforceQueueLimits(transport);
+}
+
+void QMetaObjectPublisher::setQueueLimits(QWebChannelAbstractTransport *transport,
+                                          const QueueLimits &limits)
+{
+    if (transport)
+        transportState[transport].queueLimits = limits;
+    else
+        defaultQueueLimits = limits;
+
+    // the queued bytes are only tracked while a byte limit applies
+    for (auto it = transportState.begin(); it != transportState.end(); ++it) {
+        const QueueLimits transportLimits = queueLimits(it.key());
+        it->queuedBytes = 0;
+        for (OutgoingMessage &message : it->queuedMessages)
+            it->queuedBytes += queuedSize(message, it.key(), transportLimits);
+    }
+}
+
+QMetaObjectPublisher::QueueLimits
+QMetaObjectPublisher::queueLimits(QWebChannelAbstractTransport *transport) const
+{
+    auto found = transportState.constFind(transport);
+    if (found == transportState.constEnd() || !found->queueLimits)
+        return defaultQueueLimits;
+    return *found->queueLimits;
+}
+
+qsizetype QMetaObjectPublisher::queuedSize(OutgoingMessage &message,
+                                           QWebChannelAbstractTransport *transport,
+                                           const QueueLimits &limits) const
+{
+    if (limits.maxBytes <= 0)
+        return 0;
+    const auto format = messageFormat(transport);
+    return message.encoded(format ? format : QWebChannelAbstractTransport::JsonFormat).size();
+}
+
+void QMetaObjectPublisher::enforceQueueLimits(QWebChannelAbstractTransport *transport)
+{
+    TransportState &state = transportState[transport];
+    const QueueLimits limits = queueLimits(transport);
+    const auto exceedsLimits = [&] {
+        return (limits.maxMessages > 0 && state.queuedMessages.size() > limits.maxMessages)
+                || (limits.maxBytes > 0 && state.queuedBytes > limits.maxBytes);
+    };
+    if (!exceedsLimits())
+        return;
+
+    switch (limits.policy) {
+    case QWebChannel::CoalesceMessages: {
+        QList<QJsonObject> updates;
+        bool carriesClassInfo = false;
+        QQueue<OutgoingMessage> remaining;
+        for (OutgoingMessage &message : state.queuedMessages) {
+            if (isPropertyUpdate(message.message)) {
+                updates.append(message.merged());
+                carriesClassInfo |= message.carriesClassInfo;
+            } else {
+                remaining.append(message);
+            }
+        }
+        if (!updates.isEmpty()) {
+            remaining.append(OutgoingMessage(mergePropertyUpdates(updates)));
+            remaining.last().carriesClassInfo = carriesClassInfo;
+        }
+        state.queuedMessages = std::move(remaining);
+        state.queuedBytes = 0;
+        for (OutgoingMessage &message : state.queuedMessages)
+            state.queuedBytes += queuedSize(message, transport, limits);
+        break;
+    }
+    case QWebChannel::DropOldestMessages:
+        while (exceedsLimits() && !state.queuedMessages.isEmpty()) {
+            OutgoingMessage dropped = state.queuedMessages.dequeue();
+            state.queuedBytes -= queuedSize(dropped, transport, limits);
+        }
+        break;
+    case QWebChannel::DisconnectTransport:
+        state.queuedMessages.clear();
+        state.queuedBytes = 0;
+        state.disconnecting = true;
+        break;
+    }
+
+    // the transport is still in use further up the stack, so notify and disconnect later, as
+    // receivers of the signal may disconnect or delete the transport as well
+    QPointer<QWebChannelAbstractTransport> guard(transport);
+    QMetaObject::invokeMethod(webChannel, [channel = webChannel, guard, policy = limits.policy] {
+        if (!guard || !channel->d_func()->transports.contains(guard.get()))
+            return;
+        emit channel->queueLimitReached(guard.get(), policy);
+        if (policy == QWebChannel::DisconnectTransport && guard)
+            channel->disconnectFrom(guard.get());
+    }, Qt::QueuedConnection);
 }
 
 void QMetaObjectPublisher::sendEnqueuedPropertyUpdates(QWebChannelAbstractTransport *transport)
 {
     auto found = transportState.find(transport);
-    if (found != transportState.end() && found.value().clientIsIdle
+    if (found != transportState.end() && found.value().creditWindow > 0) {
+        // every message uses up one credit; look up the state for each message, as a client on
+        // an in-process transport may grant new credits while a message is delivered
+        while (found != transportState.end() && found.value().credits > 0
+               && !found.value().queuedMessages.isEmpty()) {
+            OutgoingMessage message = found.value().queuedMessages.dequeue();
+            found.value().queuedBytes -= queuedSize(message, transport, queueLimits(transport));
+            --found.value().credits;
+            if (message.carriesClassInfo)
+                classInfoDelivered(message.merged(), found.value().index);
+            deliverMessage(message, transport);
+            found = transportState.find(transport);
+        }
+        return;
+    }
+
+    if (found != transportState.end() && found.value().credits > 0
         && !found.value().queuedMessages.isEmpty()) {
 
         // If the client is connected with an in-process transport, it can
@@ -1057,12 +2753,19 @@ void QMetaObjectPublisher::sendEnqueuedPropertyUpdates(QWebChannelAbstractTransp
         // For that same reason set the client to "busy" (aka non-idle) just
         // right before sending out the messages; otherwise a potential
         // "Idle" type message will not correctly restore the Idle state.
-        const auto messages = std::move(found.value().queuedMessages);
+        auto messages = std::move(found.value().queuedMessages);
         Q_ASSERT(found.value().queuedMessages.isEmpty());
-        found.value().clientIsIdle = false;
-
-        for (const auto &message : messages) {
-            transport->sendMessage(message);
+        found.value().queuedBytes = 0;
+        found.value().credits = 0;
+
+        for (auto &message : messages) {
+            // the transport may have been removed while delivering the previous message
+            if (message.carriesClassInfo) {
+                found = transportState.find(transport);
+                if (found != transportState.end())
+                    classInfoDelivered(message.merged(), found.value().index);
+            }
+            deliverMessage(message, transport);
         }
     }
 }
@@ -1081,25 +2784,74 @@ void QMetaObjectPublisher::handleMessage(const QJsonObject &message, QWebChannel
 
     const MessageType type = toType(message.value(KEY_TYPE));
     if (type == TypeIdle) {
-        setClientIsIdle(true, transport);
+        if (message.contains(KEY_CREDITS))
+            grantCredits(message.value(KEY_CREDITS).toInt(), transport);
+        else
+            setClientIsIdle(true, transport);
     } else if (type == TypeInit) {
         if (!message.contains(KEY_ID)) {
             qWarning("JSON message object is missing the id property: %s",
                       QJsonDocument(message).toJson().constData());
             return;
         }
-        transport->sendMessage(createResponse(message.value(KEY_ID), initializeClient(transport)));
+        // the response to the init message is always sent as JSON, only the messages
+        // following it make use of the negotiated capabilities
+        const QJsonValue requested = message.value(KEY_CAPABILITIES);
+        const ClientCapabilities capabilities =
+                negotiateCapabilities(requested.toObject(), transport);
+        TransportState &state = transportState[transport];
+        state.capabilities = capabilities & ~ClientCapabilities(CborCapability);
+        // a new client does not know any types yet
+        state.knownTypes.clear();
+        state.pendingTypes = QJsonObject();
+        state.observedProperties.clear();
+        // nor the class information of wrapped objects
+        if (state.index >= 0) {
+            const auto ids = transportedWrappedObjects.equal_range(transport);
+            for (auto it = ids.first; it != ids.second; ++it) {
+                auto wrapped = wrappedObjects.find(it.value());
+                if (wrapped != wrappedObjects.end()
+                    && containsTransport(wrapped->classInfoSent, state.index)) {
+                    wrapped->classInfoSent.clearBit(state.index);
+                }
+            }
+        }
+        // the client grants the first credits along with its first idle message
+        state.creditWindow = qBound(0, requested.toObject().value(KEY_CREDITS).toInt(),
+                                    MaxCreditWindow);
+        const int creditWindow = state.creditWindow;
+
+        const QJsonValue data = capabilities.testFlag(LazyInitCapability)
+                ? QJsonValue(initializeLazyClient())
+                : QJsonValue(initializeClient(transport));
+        QJsonObject responseMessage = createResponse(message.value(KEY_ID), data);
+        if (!requested.isUndefined()) {
+            QJsonObject accepted = capabilitiesToJson(capabilities);
+            if (creditWindow > 0)
+                accepted[KEY_CREDITS] = creditWindow;
+            responseMessage[KEY_CAPABILITIES] = accepted;
+        }
+        attachPendingTypes(responseMessage, transport);
+        OutgoingMessage response(responseMessage);
+        deliverMessage(response, transport);
+        transportState[transport].capabilities = capabilities;
     } else if (type == TypeDebug) {
         static QTextStream out(stdout);
         out << "DEBUG: " << message.value(KEY_DATA).toString() << Qt::endl;
     } else if (message.contains(KEY_OBJECT)) {
-        const QString &objectName = message.value(KEY_OBJECT).toString();
-        QObject *object = registeredObjects.value(objectName);
-        if (!object)
-            object = wrappedObjects.value(objectName).object;
+        const QJsonValue objectAddress = message.value(KEY_OBJECT);
+        QObject *object = findObject(objectAddress);
+
+        // handles and sequential wrapped ids are easily guessed,
+        // so only accept objects the client knows
+        if (object && !isKnownTo(object, transport)) {
+            qWarning() << "Refusing to handle message for object unknown to transport"
+                       << objectAddress;
+            return;
+        }
 
         if (!object) {
-            qWarning() << "Unknown object encountered" << objectName;
+            qWarning() << "Unknown object encountered" << objectAddress;
             return;
         }
 
@@ -1118,11 +2870,13 @@ void QMetaObjectPublisher::handleMessage(const QJsonObject &message, QWebChannel
             if (method.isString()) {
                 result = invokeMethod(object,
                                       method.toString().toUtf8(),
-                                      message.value(KEY_ARGS).toArray());
+                                      message.value(KEY_ARGS).toArray(),
+                                      transport);
             } else {
                 result = invokeMethod(object,
                                       method.toInt(-1),
-                                      message.value(KEY_ARGS).toArray());
+                                      message.value(KEY_ARGS).toArray(),
+                                      transport);
             }
 
             auto sendResponse = [publisherExists, transportExists, id=message.value(KEY_ID)]
@@ -1135,7 +2889,10 @@ void QMetaObjectPublisher::handleMessage(const QJsonObject &message, QWebChannel
 
                 const auto wrappedResult =
                         publisherExists->wrapResult(result, transportExists.get());
-                transportExists->sendMessage(createResponse(id, wrappedResult));
+                QJsonObject responseMessage = createResponse(id, wrappedResult);
+                publisherExists->attachPendingTypes(responseMessage, transportExists.get());
+                OutgoingMessage response(responseMessage);
+                publisherExists->deliverMessage(response, transportExists.get());
             };
 
 #if QT_CONFIG(future)
@@ -1147,13 +2904,27 @@ void QMetaObjectPublisher::handleMessage(const QJsonObject &message, QWebChannel
 #else
             sendResponse(result);
 #endif
+        } else if (type == TypeObjectInfo) {
+            if (!message.contains(KEY_ID)) {
+                qWarning("JSON message object is missing the id property: %s",
+                          QJsonDocument(message).toJson().constData());
+                return;
+            }
+            QJsonObject responseMessage =
+                    createResponse(message.value(KEY_ID), classInfoForObject(object, transport));
+            attachPendingTypes(responseMessage, transport);
+            OutgoingMessage response(responseMessage);
+            deliverMessage(response, transport);
+        } else if (type == TypeObserveProperties) {
+            observeProperties(object, message.value(KEY_PROPERTIES).toArray(),
+                              message.value(KEY_OBSERVE).toBool(true), transport);
         } else if (type == TypeConnectToSignal) {
-            signalHandlerFor(object)->connectTo(object, message.value(KEY_SIGNAL).toInt(-1));
+            connectToSignal(object, message.value(KEY_SIGNAL).toInt(-1), transport);
         } else if (type == TypeDisconnectFromSignal) {
-            signalHandlerFor(object)->disconnectFrom(object, message.value(KEY_SIGNAL).toInt(-1));
+            disconnectFromSignal(object, message.value(KEY_SIGNAL).toInt(-1), transport);
         } else if (type == TypeSetProperty) {
             setProperty(object, message.value(KEY_PROPERTY).toInt(-1),
-                        message.value(KEY_VALUE));
+                        message.value(KEY_VALUE), transport);
         }
     }
 }
@@ -15,18 +15,27 @@
 // We mean it.
 //
 
+#include "qwebchannel.h"
 #include "qwebchannelglobal.h"
 #include "signalhandler_p.h"
 
+#include <QBitArray>
 #include <QStringList>
+#include <QMetaAssociation>
 #include <QMetaObject>
+#include <QMetaSequence>
 #include <QBasicTimer>
 #include <QPointer>
 #include <QProperty>
+#include <QJsonArray>
 #include <QJsonObject>
 #include <QQueue>
+#include <QWebChannelAbstractTransport>
 #include <QSet>
+#include <QVarLengthArray>
 
+#include <array>
+#include <optional>
 #include <unordered_map>
 
 class tst_bench_QWebChannel;
@@ -49,8 +58,41 @@ enum MessageType {
     TypeDisconnectFromSignal = 8,
     TypeSetProperty = 9,
     TypeResponse = 10,
+    TypeObjectInfo = 11,
+    TypeObserveProperties = 12,
 
-    TYPES_LAST_VALUE = 10
+    TYPES_LAST_VALUE = 12
+};
+
+// Optional protocol features a client can request in its init message.
+// NOTE: keep in sync with the capability names in qwebchannel.js
+enum ClientCapability {
+    NoCapabilities = 0x0,
+    // messages to the client are encoded as CBOR instead of JSON
+    CborCapability = 0x1,
+    // property updates use flat [index, value, ...] arrays instead of objects
+    CompactUpdatesCapability = 0x2,
+    // the class information is sent once per type and referenced by objects
+    TypeDescriptorsCapability = 0x4,
+    // the init response only lists the object ids, see TypeObjectInfo
+    LazyInitCapability = 0x8,
+    // property updates only contain the properties the client observes, see TypeObserveProperties
+    PropertyInterestCapability = 0x10,
+    // objects are addressed by integer handles instead of their ids
+    ObjectHandlesCapability = 0x20,
+    // lists of numbers are sent as base64 encoded buffers and decoded to typed arrays
+    PackedArraysCapability = 0x40,
+};
+Q_DECLARE_FLAGS(ClientCapabilities, ClientCapability)
+Q_DECLARE_OPERATORS_FOR_FLAGS(ClientCapabilities)
+
+// Property updates are created in variants for the capabilities of the clients, which are indexed
+// by a combination of these flags.
+enum UpdateFormat {
+    CompactUpdateFormat = 0x1,
+    HandleUpdateFormat = 0x2,
+
+    UpdateFormatCount = 0x4
 };
 
 class QMetaObjectPublisher;
@@ -97,23 +139,61 @@ public:
     void broadcastMessage(const QJsonObject &message) const;
 
     /**
-     * Enqueue the given @p message to all known transports.
+     * Send the given @p message to each of the @p transports.
+     *
+     * Transports which accept pre-serialized messages all get the same buffer, i.e. the message
+     * is serialized at most once.
      */
-    void enqueueBroadcastMessage(const QJsonObject &message);
+    void sendMessage(const QJsonObject &message,
+                     const QList<QWebChannelAbstractTransport *> &transports) const;
+
+    /**
+     * Enqueue to every known transport the one of @p messages that matches the UpdateFormat of
+     * the transport. Transports whose clients declare their property interest
+     * get individual updates and are skipped.
+     *
+     * @p carriesClassInfo is true if the messages may describe wrapped objects.
+     */
+    void enqueueBroadcastMessage(const std::array<QJsonObject, UpdateFormatCount> &messages,
+                                 bool carriesClassInfo);
 
     /**
      * Enqueue the given @p message to @p transport.
+     *
+     * @p carriesClassInfo is true if the message may describe wrapped objects.
      */
-    void enqueueMessage(const QJsonObject &message, QWebChannelAbstractTransport *transport);
+    void enqueueMessage(const QJsonObject &message, QWebChannelAbstractTransport *transport,
+                        bool carriesClassInfo = false);
+
+    /**
+     * Limits of the messages queued for a transport, zero or less disables a limit.
+     */
+    struct QueueLimits
+    {
+        qsizetype maxMessages = 0;
+        qsizetype maxBytes = 0;
+        QWebChannel::QueueOverflowPolicy policy = QWebChannel::CoalesceMessages;
+    };
+
+    /**
+     * Set the queue @p limits of @p transport, or the default limits when @p transport is null.
+     */
+    void setQueueLimits(QWebChannelAbstractTransport *transport, const QueueLimits &limits);
 
     /**
      * If client for given @p transport is idle, send queued messaged to @p transport and then mark
      * the client as not idle.
+     *
+     * If the client negotiated a credit window, one queued message is sent per available credit.
      */
     void sendEnqueuedPropertyUpdates(QWebChannelAbstractTransport *transport);
 
     /**
      * Serialize the QMetaObject of @p object and return it in JSON form.
+     *
+     * If the client of @p transport negotiated type descriptors, only the property values and
+     * the type id are returned. The type itself is sent along with the next response. The handle
+     * of the object is only included for a @p transport that negotiated object handles.
      */
     QJsonObject classInfoForObject(const QObject *object, QWebChannelAbstractTransport *transport);
 
@@ -123,7 +203,16 @@ public:
     void setClientIsIdle(bool isIdle, QWebChannelAbstractTransport *transport);
 
     /**
-     * Check that client is idle for @p transport.
+     * Allow sending @p credits more property update messages to the client of @p transport,
+     * which negotiated a credit window, before it has to acknowledge them.
+     *
+     * The credits are capped at the negotiated window. Without a window, this is the same as
+     * marking the client as idle.
+     */
+    void grantCredits(int credits, QWebChannelAbstractTransport *transport);
+
+    /**
+     * Check that client is idle for @p transport, i.e. messages may be sent to it.
      */
     bool isClientIdle(QWebChannelAbstractTransport *transport);
 
@@ -134,13 +223,43 @@ public:
      */
     QJsonObject initializeClient(QWebChannelAbstractTransport *transport);
 
+    /**
+     * Initialize a client that negotiated the lazy init capability by sending it only the ids of
+     * the registered objects. The class information is requested per object with a
+     * TypeObjectInfo message.
+     */
+    QJsonArray initializeLazyClient();
+
+    // Map of signal indices to the properties they notify.
+    // The value is a bit mask as a signal can be the notify signal of multiple properties.
+    typedef QHash<int, QBitArray> SignalToPropertyNameMap;
+
+    /**
+     * The class information that only depends on the QMetaObject, i.e. everything but the
+     * property values.
+     */
+    struct ClassDescriptor
+    {
+        QJsonArray qtSignals;
+        QJsonArray qtMethods;
+        QJsonObject qtEnums;
+        // [index, name, notifySignalInfo] for every property, the value is appended per object
+        QList<QJsonArray> properties;
+        // the notify signals and the bindable properties without notify signal, through which
+        // the property updates of the objects are wired
+        SignalToPropertyNameMap notifySignals;
+        QList<int> bindableProperties;
+        // identifies the class towards clients, -1 for uncached dynamic meta objects
+        int typeId = -1;
+    };
+
     /**
      * Go through all properties of the given object and connect to their notify signal.
      *
      * When receiving a notify signal, it will store the information in pendingPropertyUpdates which
      * gets send via a Qt.propertyUpdate message to the server when the grouping timer timeouts.
      */
-    void initializePropertyUpdates(QObject *const object, const QJsonObject &objectInfo);
+    void initializePropertyUpdates(QObject *const object, const ClassDescriptor &descriptor);
 
     /**
      * Send the clients the new property values since the last time this function was invoked.
@@ -153,19 +272,74 @@ public:
      */
     void sendPendingPropertyUpdates();
 
+    /**
+     * Precomputed information on how to invoke a method, so that invocations only need to
+     * convert the arguments and make the call.
+     */
+    struct MethodInvoker
+    {
+        // writes the value into the argument, a default constructed value of the type, and
+        // returns false if the value cannot be converted; objects are resolved like in toVariant
+        typedef bool (*ArgumentConverter)(const QMetaObjectPublisher &publisher,
+                                          QWebChannelAbstractTransport *transport,
+                                          const QJsonValue &value, QMetaType type,
+                                          void *argument);
+
+        // the return type followed by the parameter types, as expected by QMetaMethodInvoker
+        QVarLengthArray<QMetaType, 8> types;
+        QVarLengthArray<const char *, 8> names;
+        QVarLengthArray<const QtPrivate::QMetaTypeInterface *, 8> metaTypes;
+        // converts the JSON argument to the type of the respective parameter
+        QVarLengthArray<ArgumentConverter, 8> converters;
+    };
+
+    /**
+     * Return the MethodInvoker of @p method, creating it on first use.
+     */
+    const MethodInvoker &methodInvoker(const QMetaMethod &method);
+
+    /**
+     * Create the MethodInvoker of @p method.
+     */
+    static MethodInvoker createMethodInvoker(const QMetaMethod &method);
+
     /**
      * Helper function for the invokeMehtods below
      */
     QVariant invokeMethod_helper(QObject *const object, const QMetaMethod &method,
-                                 const QJsonArray &args);
+                                 const QJsonArray &args,
+                                 QWebChannelAbstractTransport *transport = nullptr);
+
+    /**
+     * Connect the client of @p transport to the signal of @p object with the given @p signalIndex.
+     */
+    void connectToSignal(QObject *object, int signalIndex, QWebChannelAbstractTransport *transport);
+
+    /**
+     * Disconnect the client of @p transport from the signal of @p object with the given
+     * @p signalIndex.
+     */
+    void disconnectFromSignal(QObject *object, int signalIndex,
+                              QWebChannelAbstractTransport *transport);
+
+    /**
+     * Start or, if @p observe is false, stop sending updates of the properties of @p object with
+     * the given @p propertyIndices to the client of @p transport.
+     *
+     * The current values of newly observed properties are sent to the client right away, as
+     * they might have changed since it received them.
+     */
+    void observeProperties(QObject *object, const QJsonArray &propertyIndices, bool observe,
+                           QWebChannelAbstractTransport *transport);
 
     /**
      * Invoke the @p method on @p object with the arguments @p args.
      *
      * The return value of the method invocation is then serialized and a response message
-     * is returned.
+     * is returned. Objects in @p args are resolved for the client of @p transport, see toVariant.
      */
-    QVariant invokeMethod(QObject *const object, const QMetaMethod &method, const QJsonArray &args);
+    QVariant invokeMethod(QObject *const object, const QMetaMethod &method, const QJsonArray &args,
+                          QWebChannelAbstractTransport *transport = nullptr);
 
     /**
      * Invoke the method of index @p methodIndex on @p object with the arguments @p args.
@@ -173,7 +347,8 @@ public:
      * The return value of the method invocation is then serialized and a response message
      * is returned.
      */
-    QVariant invokeMethod(QObject *const object, const int methodIndex, const QJsonArray &args);
+    QVariant invokeMethod(QObject *const object, const int methodIndex, const QJsonArray &args,
+                          QWebChannelAbstractTransport *transport = nullptr);
 
     /**
      * Invoke the method of name @p methodName on @p object with the arguments @p args.
@@ -183,17 +358,21 @@ public:
      * The return value of the method invocation is then serialized and a response message
      * is returned.
      */
-    QVariant invokeMethod(QObject *const object, const QByteArray &methodName, const QJsonArray &args);
+    QVariant invokeMethod(QObject *const object, const QByteArray &methodName,
+                          const QJsonArray &args,
+                          QWebChannelAbstractTransport *transport = nullptr);
 
     /**
-     * Set the value of property @p propertyIndex on @p object to @p value.
+     * Set the value of property @p propertyIndex on @p object to @p value, as sent by the client
+     * of @p transport.
      */
-    void setProperty(QObject *object, const int propertyIndex, const QJsonValue &value);
+    void setProperty(QObject *object, const int propertyIndex, const QJsonValue &value,
+                     QWebChannelAbstractTransport *transport = nullptr);
 
     /**
      * Callback of the signalHandler which forwards the signal invocation to the webchannel clients.
      */
-    void signalEmitted(const QObject *object, const int signalIndex, const QVariantList &arguments);
+    void signalEmitted(const QObject *object, const int signalIndex, const SignalArguments &arguments);
 
     /**
      * Callback for bindable property value changes which forwards the change to the webchannel clients.
@@ -213,12 +392,61 @@ public:
      */
     void objectDestroyed(const QObject *object);
 
-    QObject *unwrapObject(const QString &objectId) const;
-    QVariant unwrapMap(QVariantMap map) const;
-    QVariant unwrapList(QVariantList list) const;
-    QVariant unwrapVariant(const QVariant &value) const;
+    /**
+     * Returns the registered or wrapped object with the given id or handle @p objectId, or null
+     * if there is none.
+     */
+    QObject *findObject(const QJsonValue &objectId) const;
 
-    QVariant toVariant(const QJsonValue &value, int targetType) const;
+    /**
+     * Returns the registered or wrapped object with the given id or handle @p objectId.
+     *
+     * With a @p transport, only objects known to its client are returned, see isKnownTo.
+     */
+    QObject *unwrapObject(const QString &objectId,
+                          QWebChannelAbstractTransport *transport = nullptr) const;
+    QObject *unwrapObject(const QJsonValue &objectId,
+                          QWebChannelAbstractTransport *transport = nullptr) const;
+
+    /**
+     * Returns the handle of the registered or wrapped @p object, or -1 if it has none.
+     */
+    qint64 objectHandle(const QObject *object) const;
+
+    /**
+     * Returns the object with the given @p handle, or null if the handle is invalid or stale.
+     */
+    QObject *objectForHandle(qint64 handle) const;
+
+    /**
+     * Returns true if the client of @p transport knows @p object, i.e. it is registered or was
+     * wrapped for that client.
+     */
+    bool isKnownTo(const QObject *object, QWebChannelAbstractTransport *transport) const;
+    QVariant unwrapMap(QVariantMap map, QWebChannelAbstractTransport *transport = nullptr) const;
+    QVariant unwrapList(QVariantList list,
+                        QWebChannelAbstractTransport *transport = nullptr) const;
+    QVariant unwrapVariant(const QVariant &value,
+                           QWebChannelAbstractTransport *transport = nullptr) const;
+
+    /**
+     * Convert @p value sent by the client of @p transport to @p targetType.
+     *
+     * Objects are only resolved if that client knows them. Without a @p transport, e.g. for
+     * calls from the application itself, all registered and wrapped objects are resolved.
+     */
+    QVariant toVariant(const QJsonValue &value, int targetType,
+                       QWebChannelAbstractTransport *transport = nullptr) const;
+
+    /**
+     * Convert @p value to an argument or property value of @p type.
+     *
+     * This gives the same result as toVariant, but converts values to common types like int,
+     * double or QString directly, without the generic QVariant conversion. Returns an invalid
+     * QVariant if @p value cannot be converted.
+     */
+    QVariant toArgument(const QJsonValue &value, QMetaType type,
+                        QWebChannelAbstractTransport *transport = nullptr) const;
 
     /**
      * Assigns a score for the conversion from @p value to @p targetType.
@@ -228,7 +456,8 @@ public:
      *
      * @sa invokeMethod, methodOverloadBadness
      */
-    int conversionScore(const QJsonValue &value, int targetType) const;
+    int conversionScore(const QJsonValue &value, int targetType,
+                        QWebChannelAbstractTransport *transport = nullptr) const;
 
     /**
      * Scores @p method against @p args.
@@ -238,7 +467,15 @@ public:
      *
      * @sa invokeMethod, conversionScore
      */
-    int methodOverloadBadness(const QMetaMethod &method, const QJsonArray &args) const;
+    int methodOverloadBadness(const QMetaMethod &method, const QJsonArray &args,
+                              QWebChannelAbstractTransport *transport = nullptr) const;
+
+    /**
+     * Describes the kinds of the JSON values in @p args, as far as they matter for the
+     * conversionScore. Calls with the same argument kinds resolve to the same overload.
+     */
+    QByteArray argumentKinds(const QJsonArray &args,
+                             QWebChannelAbstractTransport *transport = nullptr) const;
 
     /**
      * Remove wrapped objects which last transport relation is with the passed transport object.
@@ -250,9 +487,14 @@ public:
      * return the objects class information.
      *
      * All other input types are returned as-is.
+     *
+     * The class information of wrapped objects is omitted for clients that already know the
+     * object. Without a @p transport, these are the indices of the transports in @p recipients,
+     * which receive the result. An empty set of recipients always includes the class information.
      */
     QJsonValue wrapResult(const QVariant &result, QWebChannelAbstractTransport *transport,
-                          const QString &parentObjectId = QString());
+                          const QString &parentObjectId = QString(),
+                          const QBitArray &recipients = QBitArray());
 
     /**
      * Convert a list of variant values for consumption by the client.
@@ -260,7 +502,16 @@ public:
      * This properly handles QML values and also wraps the result if required.
      */
     QJsonArray wrapList(const QVariantList &list, QWebChannelAbstractTransport *transport,
-                          const QString &parentObjectId = QString());
+                          const QString &parentObjectId = QString(),
+                          const QBitArray &recipients = QBitArray());
+
+    /**
+     * Convert the arguments of a signal invocation for consumption by the client.
+     *
+     * Arguments of common primitive types are converted directly, all others like in wrapList.
+     */
+    QJsonArray wrapArguments(const SignalArguments &arguments, const QString &parentObjectId,
+                             const QBitArray &recipients);
 
     /**
      * Convert a variant map for consumption by the client.
@@ -268,7 +519,14 @@ public:
      * This properly handles QML values and also wraps the result if required.
      */
     QJsonObject wrapMap(const QVariantMap &map, QWebChannelAbstractTransport *transport,
-                          const QString &parentObjectId = QString());
+                          const QString &parentObjectId = QString(),
+                          const QBitArray &recipients = QBitArray());
+
+    /**
+     * Add the handles to the class information of the objects in @p value, which was wrapped
+     * without a transport, for the clients that negotiated object handles.
+     */
+    QJsonValue addObjectHandles(const QJsonValue &value) const;
 
     /**
      * Invoke delete later on @p object.
@@ -318,16 +576,245 @@ private:
     std::unordered_map<const QThread*, SignalHandler<QMetaObjectPublisher>> signalHandlers;
     SignalHandler<QMetaObjectPublisher> *signalHandlerFor(const QObject *object);
 
+    // A message together with its lazily computed serialization, which is shared
+    // between all transports the message is sent to.
+    struct OutgoingMessage
+    {
+        OutgoingMessage(const QJsonObject &message = QJsonObject()) : message(message) { }
+        QJsonObject message;
+        // compact JSON serialization of message, empty until needed
+        QByteArray json;
+        // CBOR serialization of message, empty until needed
+        QByteArray cbor;
+        // property updates queued after message, merged into it once it is needed
+        QList<QJsonObject> laterUpdates;
+        // true if message may describe wrapped objects, which the client only knows once the
+        // message is delivered
+        bool carriesClassInfo = false;
+
+        const QByteArray &encoded(QWebChannelAbstractTransport::MessageFormat format);
+        const QJsonObject &merged();
+    };
+
+    /**
+     * Send @p message to @p transport, either as JSON object or pre-serialized if the
+     * transport supports that. The serialization is cached in @p message.
+     */
+    void deliverMessage(OutgoingMessage &message, QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Returns the format in which messages are sent to @p transport, or zero when the transport
+     * does not accept pre-serialized messages.
+     */
+    QWebChannelAbstractTransport::MessageFormat
+    messageFormat(QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Returns the pre-serialized formats @p transport accepts, which requires it to declare a
+     * sendEncodedMessage(QByteArray, QWebChannelAbstractTransport::MessageFormat) slot.
+     */
+    QWebChannelAbstractTransport::MessageFormats
+    encodedMessageFormats(QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Returns the sendEncodedMessage slot of @p transport, which is looked up once per class.
+     */
+    QMetaMethod encodedMessageSlot(QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Append @p message to the queue of @p transport and enforce the queue limits.
+     */
+    void appendToQueue(const OutgoingMessage &message, QWebChannelAbstractTransport *transport);
+
+    /**
+     * Returns the queue limits that apply to @p transport.
+     */
+    QueueLimits queueLimits(QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Returns the serialized size of @p message for @p transport when @p limits restrict the
+     * queued bytes, zero otherwise.
+     */
+    qsizetype queuedSize(OutgoingMessage &message, QWebChannelAbstractTransport *transport,
+                         const QueueLimits &limits) const;
+
+    /**
+     * Reduce the queue of @p transport according to the overflow policy when it exceeds its
+     * limits, and notify about it.
+     */
+    void enforceQueueLimits(QWebChannelAbstractTransport *transport);
+
+    /**
+     * Returns the UpdateFormat in which property updates are sent to @p transport.
+     */
+    int updateFormat(QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Returns how @p object with the given @p objectId is addressed in messages to clients, which
+     * is its handle when @p useHandle is set.
+     */
+    QJsonValue objectAddress(const QObject *object, const QString &objectId, bool useHandle) const;
+
+    /**
+     * Assign a handle to @p object, which stays valid until it is released.
+     */
+    qint64 assignHandle(QObject *object);
+
+    /**
+     * Release the handle of @p object, so that its slot can be reused.
+     */
+    void releaseHandle(const QObject *object);
+
+    /**
+     * Return the dense index of @p transport, assigning one if the transport has none yet.
+     */
+    qsizetype transportIndex(QWebChannelAbstractTransport *transport);
+
+    /**
+     * Returns a new id for a wrapped object in the configured format, which does not collide
+     * with the id of a registered or wrapped object.
+     */
+    QString createWrappedObjectId();
+
+    /**
+     * Return the transports whose index is set in @p transports.
+     */
+    QList<QWebChannelAbstractTransport *> transportsInSet(const QBitArray &transports) const;
+
+    /**
+     * Record that the transports in @p receivers got the class information of the wrapped
+     * object with the given @p id. This also makes the object known to them.
+     */
+    void setClassInfoSent(const QString &id, const QBitArray &receivers);
+
+    /**
+     * Record that the client of the transport with the given @p index got the class information
+     * of the wrapped objects described in @p value, which is part of a message delivered to it.
+     */
+    void classInfoDelivered(const QJsonValue &value, qsizetype index);
+
+    /**
+     * Returns true when @p capability was negotiated with the client of @p transport.
+     */
+    bool hasCapability(QWebChannelAbstractTransport *transport, ClientCapability capability) const;
+
+    /**
+     * Returns true if lists of numbers are packed for @p transport or, without a transport, for
+     * all transports in @p recipients.
+     */
+    bool packsArrays(QWebChannelAbstractTransport *transport, const QBitArray &recipients) const;
+
+    /**
+     * Returns the properties of @p object which the client of @p transport observes.
+     */
+    QBitArray observedProperties(QWebChannelAbstractTransport *transport,
+                                 const QObject *object) const;
+
+    /**
+     * Encode the @p message as CBOR, the binary equivalent of the JSON message.
+     */
+    static QByteArray encodeCbor(const QJsonObject &message);
+
+    /**
+     * Determine which of the @p requested capabilities are supported for @p transport.
+     */
+    ClientCapabilities negotiateCapabilities(const QJsonObject &requested,
+                                             QWebChannelAbstractTransport *transport) const;
+
+    /**
+     * Reflect the @p metaObject into a ClassDescriptor.
+     */
+    static ClassDescriptor createClassDescriptor(const QMetaObject *metaObject);
+
+    /**
+     * Returns the ClassDescriptor for the meta object of @p object, which is cached unless the
+     * meta object is dynamic.
+     */
+    ClassDescriptor classDescriptor(const QObject *object);
+
+    // How wrapResult converts values of a type that are not QObjects
+    enum TypeCategory {
+        PlainType,
+        EnumType,
+        FlagsType,
+        JSValueType,
+        ListType,
+        MapType,
+        JsonConvertibleType,
+    };
+
+    struct TypeClassification
+    {
+        // true if values of the type may be QObjects, which are wrapped unless they are null
+        bool mayBeObject = false;
+        TypeCategory category = PlainType;
+        // Containers whose elements are of a plain JSON type, i.e. sequences or associations with
+        // string keys, are converted element by element with this function, skipping the
+        // conversion to a QVariantList or QVariantMap.
+        QJsonValue (*elementToJson)(const void *data) = nullptr;
+        QMetaSequence sequence;
+        QMetaAssociation association;
+    };
+
+    /**
+     * Returns the classification of @p type, which is computed once per type.
+     */
+    TypeClassification classifyType(QMetaType type) const;
+
+    /**
+     * Attach the types which were referenced for the first time in messages to @p transport to
+     * the @p response and reset them.
+     */
+    void attachPendingTypes(QJsonObject &response, QWebChannelAbstractTransport *transport);
+
     struct TransportState
     {
-        TransportState() : clientIsIdle(false) { }
-        // true when the client is idle, false otherwise
-        bool clientIsIdle;
+        TransportState()
+            : index(-1), credits(0), creditWindow(0), queuedBytes(0), disconnecting(false)
+        { }
+        // position of the transport in indexedTransports, -1 until it is assigned
+        qsizetype index;
+        // number of property update messages the client accepts before acknowledging them, the
+        // client is idle when this is positive
+        int credits;
+        // maximum number of credits granted by the client, zero for the idle handshake where a
+        // single acknowledgement allows sending all queued messages
+        int creditWindow;
+        // optional protocol features negotiated with the client
+        ClientCapabilities capabilities;
+        // type ids of the classes the client knows about
+        QSet<int> knownTypes;
+        // type descriptors that still need to be sent to the client
+        QJsonObject pendingTypes;
+        // properties the client observes per object, only used with PropertyInterestCapability
+        QHash<const QObject *, QBitArray> observedProperties;
         // messages to send
-        QQueue<QJsonObject> queuedMessages;
+        QQueue<OutgoingMessage> queuedMessages;
+        // serialized size of the queued messages, only tracked while a byte limit applies
+        qsizetype queuedBytes;
+        // limits of queuedMessages, if they differ from defaultQueueLimits
+        std::optional<QueueLimits> queueLimits;
+        // true once the transport exceeded its limits with the DisconnectTransport policy, no
+        // further messages are queued until it is disconnected
+        bool disconnecting;
     };
     QHash<QWebChannelAbstractTransport *, TransportState> transportState;
 
+    // Transports by their dense index, which is reused once the transport is removed. The sets of
+    // transports that know a wrapped object are stored as bitsets of these indices.
+    QList<QWebChannelAbstractTransport *> indexedTransports;
+    QList<qsizetype> freeTransportIndices;
+
+    // limits of the queued messages of transports without limits of their own
+    QueueLimits defaultQueueLimits;
+
+    // sendEncodedMessage slots of the transport classes, invalid for classes without one
+    mutable QHash<const QMetaObject *, QMetaMethod> encodedMessageSlots;
+
+    // format of the ids of wrapped objects, and the next sequential id
+    QWebChannel::WrappedObjectIdFormat wrappedObjectIdFormat = QWebChannel::SequentialIds;
+    quint64 nextWrappedObjectId = 0;
+
     // true when no property updates should be sent, false otherwise
     Q_OBJECT_BINDABLE_PROPERTY(QMetaObjectPublisher, bool, blockUpdatesStatus);
 
@@ -349,6 +836,19 @@ private:
     // Map the registered objects to their id.
     QHash<const QObject *, QString> registeredObjectIds;
 
+    // Slots of the objects that have a handle. A handle combines the index of the slot with its
+    // generation, which is incremented whenever the slot is released, so that handles of
+    // destroyed objects do not address the object that reuses the slot.
+    struct ObjectSlot
+    {
+        QObject *object = nullptr;
+        quint32 generation = 0;
+    };
+    QList<ObjectSlot> objectSlots;
+    QList<qsizetype> freeObjectSlots;
+    // Map of registered and wrapped objects to their handle
+    QHash<const QObject *, qint64> objectHandles;
+
     // Groups individually wrapped objects with their class information and the transports that have access to it.
     // Also tags objects that are in the process of being wrapped to prevent infinite recursion.
     struct ObjectInfo
@@ -357,7 +857,11 @@ private:
             : object(o), isBeingWrapped(false)
         {}
         QObject *object;
-        QList<QWebChannelAbstractTransport *> transports;
+        // indices of the transports that know the object
+        QBitArray transports;
+        // indices of the transports that received the class information of the object,
+        // a subset of transports
+        QBitArray classInfoSent;
         bool isBeingWrapped;
     };
 
@@ -366,38 +870,91 @@ private:
     // Map of transports to wrapped object ids
     QMultiHash<QWebChannelAbstractTransport*, QString> transportedWrappedObjects;
 
-    // Map of objects to maps of signal indices to a set of all their property indices.
-    // The last value is a set as a signal can be the notify signal of multiple properties.
-    typedef QHash<int, QSet<int> > SignalToPropertyNameMap;
+    // True while wrapping values for property updates. They are queued and may be merged or
+    // dropped, so the class information in them is only recorded once they are delivered, see
+    // classInfoDelivered. deferredClassInfo tells whether any class information was wrapped.
+    bool deferClassInfoSent = false;
+    bool deferredClassInfo = false;
+
+    // Map of objects to maps of signal indices to the transports whose clients connected to the
+    // signal, and how often they did so. Only these transports receive the signal.
+    typedef QHash<QWebChannelAbstractTransport *, int> SignalSubscribers;
+    QHash<const QObject *, QHash<int, SignalSubscribers>> signalSubscriptions;
+
+    // Map of objects to the notify signals of their class. The maps are shared with the
+    // ClassDescriptor, except for dynamic meta objects that gained notify signals over time.
     QHash<const QObject *, SignalToPropertyNameMap> signalToPropertyMap;
 
+    // Class information of all static meta objects published so far
+    QHash<const QMetaObject *, ClassDescriptor> classDescriptors;
+
+    // Classification of all types wrapped or converted so far, indexed by their id
+    mutable QHash<int, TypeClassification> typeClassifications;
+
+    // Methods called by name are looked up by their meta object, name and argumentKinds, so that
+    // the overload resolution only happens once for each combination
+    struct OverloadResolutionKey
+    {
+        const QMetaObject *metaObject = nullptr;
+        QByteArray methodName;
+        QByteArray argumentKinds;
+
+        friend bool operator==(const OverloadResolutionKey &lhs,
+                               const OverloadResolutionKey &rhs) noexcept
+        {
+            return lhs.metaObject == rhs.metaObject && lhs.methodName == rhs.methodName
+                    && lhs.argumentKinds == rhs.argumentKinds;
+        }
+        friend size_t qHash(const OverloadResolutionKey &key, size_t seed = 0) noexcept
+        {
+            return qHashMulti(seed, key.metaObject, key.methodName, key.argumentKinds);
+        }
+    };
+    struct OverloadResolution
+    {
+        // invalid if there is no candidate
+        QMetaMethod method;
+        // true if another candidate matches as well as the chosen method
+        bool ambiguous = false;
+    };
+    QHash<OverloadResolutionKey, OverloadResolution> overloadResolutions;
+
     // Keeps property observers alive for as long as we track an object
     std::unordered_multimap<const QObject*, QWebChannelPropertyChangeNotifier> propertyObservers;
 
-    // Objects that changed their properties and are waiting for idle client.
-    typedef QHash<int, QVariantList> SignalToArgumentsMap;
+    // Invokers of the methods called so far, indexed by the meta object and the method index.
+    // References to the invokers stay valid while further methods are added.
+    struct MethodKeyHash
+    {
+        size_t operator()(const std::pair<const QMetaObject *, int> &key) const noexcept
+        {
+            return qHash(key);
+        }
+    };
+    std::unordered_map<std::pair<const QMetaObject *, int>, MethodInvoker, MethodKeyHash>
+            methodInvokers;
 
-    // A set of plain property index (for bindable properties) and a map of
-    // signal index to arguments (for property updates from a notify signal).
-    // NOTIFY signals and their arguments are first collected and then mapped to
-    // the corresponding property in sendPendingPropertyUpdates()
+    // The changes of an object that is waiting for idle clients: the bits of the changed
+    // properties, both of bindable properties and of those notified by the signals, and the
+    // arguments of the last emission of each notify signal.
     struct PropertyUpdate
     {
-    public:
-        SignalToArgumentsMap signalMap;
-        QSet<int> plainProperties;
-
-        /**
-         * Given a SignalToPropertyNameMap, returns the set of all property
-         * indices of properties that were changed in this PropertyUpdate.
-         */
-        QSet<int> propertyIndices(const SignalToPropertyNameMap &map) const;
+        QBitArray properties;
+        QList<std::pair<int, QJsonArray>> signalArguments;
+        // true if the slot of the object is in dirtyObjectSlots
+        bool isPending = false;
     };
 
-    // map of object to either a property index for plain bindable properties
-    // or a to map of signal index to arguments
-    typedef QHash<const QObject *, PropertyUpdate> PendingPropertyUpdates;
-    PendingPropertyUpdates pendingPropertyUpdates;
+    // Pending property updates indexed by the handle slot of the object, and the slots that
+    // have pending updates, in the order they changed first
+    QList<PropertyUpdate> pendingPropertyUpdates;
+    QList<qsizetype> dirtyObjectSlots;
+
+    /**
+     * Returns the pending update of @p object, marking the object as changed, or null if the
+     * object has no handle and thus is not published.
+     */
+    PropertyUpdate *pendingPropertyUpdate(const QObject *object);
 
     // Aggregate property updates since we get multiple Qt.idle message when we have multiple
     // clients. They all share the same QWebProcess though so we must take special care to
@@ -405,14 +962,6 @@ private:
     QBasicTimer timer;
 };
 
-inline QSet<int> QMetaObjectPublisher::PropertyUpdate::propertyIndices(const SignalToPropertyNameMap &map) const {
-    auto indexes = plainProperties;
-    for (auto it = signalMap.cbegin(); it != signalMap.cend(); ++it) {
-        indexes += map.value(it.key());
-    }
-    return indexes;
-}
-
 QT_END_NAMESPACE
 
 #endif // QMETAOBJECTPUBLISHER_P_H
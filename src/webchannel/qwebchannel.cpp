@@ -168,6 +168,9 @@ QHash<QString, QObject *> QWebChannel::registeredObjects() const
     A property that is \c BINDABLE but does not have a \c NOTIFY signal will have working property
     updates on the client side, but no mechanism to register a callback for the change notifications.
 
+    An \a id that is currently used by an object the channel published as a method result or
+    property value is rejected with a warning.
+
     \note A current limitation is that objects must be registered before any client is initialized.
 
     \sa QWebChannel::registerObjects(), QWebChannel::deregisterObject(), QWebChannel::registeredObjects()
@@ -199,7 +202,12 @@ void QWebChannel::deregisterObject(QObject *object)
 {
     Q_D(QWebChannel);
     // handling of deregistration is analogously to handling of a destroyed signal
-    d->publisher->signalEmitted(object, s_destroyedSignalIndex, QVariantList() << QVariant::fromValue(object));
+    static const SignalArgumentTypes destroyedArgumentTypes =
+            signalArgumentTypes(QObject::staticMetaObject.method(s_destroyedSignalIndex));
+    QObject *argument = object;
+    void *argumentData[] = { nullptr, &argument };
+    d->publisher->signalEmitted(object, s_destroyedSignalIndex,
+                                SignalArguments(destroyedArgumentTypes, argumentData));
 }
 
 /*!
@@ -280,6 +288,102 @@ QBindable<int> QWebChannel::bindablePropertyUpdateInterval()
     return &d->publisher->propertyUpdateIntervalTime;
 }
 
+/*!
+    \enum QWebChannel::QueueOverflowPolicy
+    \since 6.9
+
+    This enum describes what happens when the messages queued for a client exceed the limits
+    set with setQueueLimits().
+
+    \value CoalesceMessages The queued property updates are merged into a single update with the
+           latest property values. This is the default.
+    \value DropOldestMessages The oldest queued messages are dropped until the queue is within
+           its limits again. The client then misses the changes they carried.
+    \value DisconnectTransport The queued messages are dropped and the transport is
+           disconnected from the channel.
+*/
+
+/*!
+    \since 6.9
+
+    Limits the messages that are queued for the client of \a transport to \a maxMessages
+    messages and \a maxBytes bytes of serialized data. A limit of zero or less disables the
+    respective check. If \a transport is \nullptr, the limits apply to all transports that do
+    not have limits of their own.
+
+    Property updates are queued while a client did not yet acknowledge the previous ones, so a
+    client that stalls would otherwise make the queue grow without bounds. Once a limit is
+    exceeded, the queue is reduced according to \a policy and queueLimitReached() is emitted.
+
+    The limits of a \a transport are forgotten when it is disconnected from the channel, so they
+    need to be set again if it is connected once more.
+
+    By default, the queues are not limited.
+
+    \sa queueLimitReached()
+*/
+void QWebChannel::setQueueLimits(QWebChannelAbstractTransport *transport, qsizetype maxMessages,
+                                 qsizetype maxBytes, QueueOverflowPolicy policy)
+{
+    Q_D(QWebChannel);
+    d->publisher->setQueueLimits(transport, { maxMessages, maxBytes, policy });
+}
+
+/*!
+    \enum QWebChannel::WrappedObjectIdFormat
+    \since 6.9
+
+    This enum describes the ids that are assigned to objects which are not registered, but
+    passed to remote clients as return values, property values or signal arguments.
+
+    \value SequentialIds The ids are taken from a counter of the channel. This is the default.
+    \value UuidIds Every id is a newly created QUuid, as in previous versions.
+*/
+
+/*!
+    \since 6.9
+
+    Returns the format of the ids of wrapped objects.
+
+    \sa setWrappedObjectIdFormat()
+*/
+QWebChannel::WrappedObjectIdFormat QWebChannel::wrappedObjectIdFormat() const
+{
+    Q_D(const QWebChannel);
+    return d->publisher->wrappedObjectIdFormat;
+}
+
+/*!
+    \since 6.9
+
+    Sets the \a format of the ids that are assigned to objects when they are wrapped from now on.
+    The ids of objects that are already wrapped do not change.
+
+    Sequential ids never collide with the ids of registered objects. Use UuidIds if the ids of
+    wrapped objects must be unique beyond the lifetime of the channel.
+*/
+void QWebChannel::setWrappedObjectIdFormat(WrappedObjectIdFormat format)
+{
+    Q_D(QWebChannel);
+    d->publisher->wrappedObjectIdFormat = format;
+}
+
+/*!
+    \fn void QWebChannel::queueLimitReached(QWebChannelAbstractTransport *transport, QWebChannel::QueueOverflowPolicy policy)
+    \since 6.9
+
+    This signal is emitted when the messages queued for the client of \a transport exceeded the
+    limits set with setQueueLimits() and were reduced according to \a policy.
+
+    The signal is emitted once control returns to the event loop, so connected slots may
+    disconnect or delete the \a transport. It is not emitted for transports that were
+    disconnected in the meantime.
+
+    With the DisconnectTransport policy, the transport is disconnected right after the signal was
+    emitted. Until then, no further messages are queued for it and the signal is not emitted
+    again.
+*/
+
 /*!
     Connects the QWebChannel to the given \a transport object.
 
@@ -26,6 +26,19 @@ class Q_WEBCHANNEL_EXPORT QWebChannel : public QObject
     Q_PROPERTY(int propertyUpdateInterval READ propertyUpdateInterval WRITE
                        setPropertyUpdateInterval BINDABLE bindablePropertyUpdateInterval)
 public:
+    enum QueueOverflowPolicy {
+        CoalesceMessages,
+        DropOldestMessages,
+        DisconnectTransport,
+    };
+    Q_ENUM(QueueOverflowPolicy)
+
+    enum WrappedObjectIdFormat {
+        SequentialIds,
+        UuidIds,
+    };
+    Q_ENUM(WrappedObjectIdFormat)
+
     explicit QWebChannel(QObject *parent = nullptr);
     ~QWebChannel();
 
@@ -42,8 +55,16 @@ public:
     void setPropertyUpdateInterval(int ms);
     QBindable<int> bindablePropertyUpdateInterval();
 
+    void setQueueLimits(QWebChannelAbstractTransport *transport, qsizetype maxMessages,
+                        qsizetype maxBytes, QueueOverflowPolicy policy = CoalesceMessages);
+
+    WrappedObjectIdFormat wrappedObjectIdFormat() const;
+    void setWrappedObjectIdFormat(WrappedObjectIdFormat format);
+
 Q_SIGNALS:
     void blockUpdatesChanged(bool block);
+    void queueLimitReached(QWebChannelAbstractTransport *transport,
+                           QWebChannel::QueueOverflowPolicy policy);
 
 public Q_SLOTS:
     void connectTo(QWebChannelAbstractTransport *transport);
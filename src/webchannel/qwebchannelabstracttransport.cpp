@@ -3,6 +3,9 @@
 
 #include "qwebchannelabstracttransport.h"
 
+#include <QJsonObject>
+#include <QVariant>
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -17,6 +20,10 @@ QT_BEGIN_NAMESPACE
     The \l{Qt WebChannel Standalone Example} shows how this can be done
     using \l{Qt WebSockets}.
 
+    Transports which serialize the messages anyway can additionally accept pre-serialized
+    messages, see setSupportedMessageFormats(). Messages that are sent to multiple clients, such
+    as property updates, are then serialized only once.
+
     \note The JSON message protocol is considered internal and might change over time.
 
     \sa {Qt WebChannel Standalone Example}
@@ -36,6 +43,23 @@ QT_BEGIN_NAMESPACE
     transmit it to the remote JavaScript client.
 */
 
+/*!
+    \enum QWebChannelAbstractTransport::MessageFormat
+    \since 6.9
+
+    This enum describes the pre-serialized message formats a transport can accept,
+    see setSupportedMessageFormats().
+
+    \value JsonFormat The message is a compact UTF-8 encoded JSON document.
+    \value CborFormat The message is the binary CBOR encoding of the JSON message. It is only
+           used for clients that requested it when initializing the QWebChannel, and should be
+           transmitted as binary data, e.g. with QWebSocket::sendBinaryMessage().
+
+    \sa supportedMessageFormats(), setSupportedMessageFormats()
+*/
+
+static const char supportedMessageFormatsProperty[] = "_q_webChannelSupportedMessageFormats";
+
 /*!
     Constructs a transport object with the given \a parent.
 */
@@ -53,4 +77,64 @@ QWebChannelAbstractTransport::~QWebChannelAbstractTransport()
 
 }
 
+/*!
+    \since 6.9
+
+    Returns the pre-serialized message formats this transport accepts.
+
+    By default, no formats are supported, i.e. all messages are passed to sendMessage().
+
+    \sa setSupportedMessageFormats()
+*/
+QWebChannelAbstractTransport::MessageFormats
+QWebChannelAbstractTransport::supportedMessageFormats() const
+{
+    return MessageFormats::fromInt(property(supportedMessageFormatsProperty).toInt());
+}
+
+/*!
+    \since 6.9
+
+    Sets the pre-serialized message \a formats this transport accepts.
+
+    Transports that serialize every message anyway, e.g. to send it over a socket, should set
+    the formats they can transmit as-is. The QWebChannel then serializes a message that is sent to
+    multiple clients only once and passes the same buffer to all of them.
+
+    The pre-serialized messages are passed to a slot of the transport with the signature
+    \c{sendEncodedMessage(const QByteArray &message, QWebChannelAbstractTransport::MessageFormat format)},
+    which the transport has to declare. Transports without such a slot receive all messages
+    through sendMessage().
+
+    \code
+    class SocketTransport : public QWebChannelAbstractTransport
+    {
+        Q_OBJECT
+    public:
+        SocketTransport(QWebSocket *socket) : m_socket(socket)
+        {
+            setSupportedMessageFormats(JsonFormat | CborFormat);
+        }
+
+    public slots:
+        void sendMessage(const QJsonObject &message) override;
+        void sendEncodedMessage(const QByteArray &message,
+                                QWebChannelAbstractTransport::MessageFormat format)
+        {
+            if (format == CborFormat)
+                m_socket->sendBinaryMessage(message);
+            else
+                m_socket->sendTextMessage(QString::fromUtf8(message));
+        }
+        ...
+    };
+    \endcode
+
+    \sa supportedMessageFormats(), sendMessage()
+*/
+void QWebChannelAbstractTransport::setSupportedMessageFormats(MessageFormats formats)
+{
+    setProperty(supportedMessageFormatsProperty, formats.toInt());
+}
+
 QT_END_NAMESPACE
@@ -14,9 +14,19 @@ class Q_WEBCHANNEL_EXPORT QWebChannelAbstractTransport : public QObject
 {
     Q_OBJECT
 public:
+    enum MessageFormat {
+        JsonFormat = 0x1,
+        CborFormat = 0x2,
+    };
+    Q_DECLARE_FLAGS(MessageFormats, MessageFormat)
+    Q_FLAG(MessageFormats)
+
     explicit QWebChannelAbstractTransport(QObject *parent = nullptr);
     ~QWebChannelAbstractTransport() override;
 
+    MessageFormats supportedMessageFormats() const;
+    void setSupportedMessageFormats(MessageFormats formats);
+
 public Q_SLOTS:
     virtual void sendMessage(const QJsonObject &message) = 0;
 
@@ -24,6 +34,8 @@ Q_SIGNALS:
     void messageReceived(const QJsonObject &message, QWebChannelAbstractTransport *transport);
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QWebChannelAbstractTransport::MessageFormats)
+
 QT_END_NAMESPACE
 
 #endif // QWEBCHANNELABSTRACTTRANSPORT_H
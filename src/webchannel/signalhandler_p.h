@@ -21,17 +21,148 @@
 #include <QMetaMethod>
 #include <QDebug>
 #include <QThread>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QStringList>
 
 QT_BEGIN_NAMESPACE
 
 static const int s_destroyedSignalIndex = QObject::staticMetaObject.indexOfMethod("destroyed(QObject*)");
 
+/**
+ * The type of a signal argument.
+ *
+ * For common primitive types, @c toJson converts the argument data to JSON directly, without
+ * creating a QVariant first, with the same result as QJsonValue::fromVariant. It is null for all
+ * other types.
+ */
+struct SignalArgumentType
+{
+    QMetaType type;
+    QJsonValue (*toJson)(const void *data) = nullptr;
+};
+typedef QList<SignalArgumentType> SignalArgumentTypes;
+
+template<typename T>
+QJsonValue signalArgumentToJson(const void *data)
+{
+    return QJsonValue(*static_cast<const T *>(data));
+}
+
+template<>
+inline QJsonValue signalArgumentToJson<double>(const void *data)
+{
+    // JSON cannot represent NaN and infinity
+    const double value = *static_cast<const double *>(data);
+    return qIsFinite(value) ? QJsonValue(value) : QJsonValue();
+}
+
+template<>
+inline QJsonValue signalArgumentToJson<QStringList>(const void *data)
+{
+    return QJsonArray::fromStringList(*static_cast<const QStringList *>(data));
+}
+
+/**
+ * Return the types of the parameters of @p signal, see also QSignalSpy::initArgs.
+ */
+inline SignalArgumentTypes signalArgumentTypes(const QMetaMethod &signal)
+{
+    SignalArgumentTypes args;
+    args.reserve(signal.parameterCount());
+    for (int i = 0; i < signal.parameterCount(); ++i) {
+        SignalArgumentType arg;
+        arg.type = signal.parameterMetaType(i);
+        switch (arg.type.id()) {
+        case QMetaType::UnknownType:
+            qWarning("Don't know how to handle '%s', use qRegisterMetaType to register it.",
+                    signal.parameterNames().at(i).constData());
+            break;
+        case QMetaType::Int:
+            arg.toJson = signalArgumentToJson<int>;
+            break;
+        case QMetaType::Double:
+            arg.toJson = signalArgumentToJson<double>;
+            break;
+        case QMetaType::Bool:
+            arg.toJson = signalArgumentToJson<bool>;
+            break;
+        case QMetaType::QString:
+            arg.toJson = signalArgumentToJson<QString>;
+            break;
+        case QMetaType::QStringList:
+            arg.toJson = signalArgumentToJson<QStringList>;
+            break;
+        }
+        args << arg;
+    }
+    return args;
+}
+
+/**
+ * The arguments of a signal invocation.
+ *
+ * This only refers to the argument data of the invocation, so that signals are dispatched without
+ * copying their arguments. It must not be used after the invocation returned.
+ */
+class SignalArguments
+{
+public:
+    SignalArguments(const SignalArgumentTypes &types, void **data)
+        : m_types(types), m_data(data)
+    {}
+
+    qsizetype size() const { return m_types.size(); }
+    bool isEmpty() const { return m_types.isEmpty(); }
+
+    /**
+     * Return the argument at @p index as a QVariant.
+     */
+    QVariant value(qsizetype index) const
+    {
+        const QMetaType type = m_types.at(index).type;
+        if (type.id() == QMetaType::QVariant)
+            return *static_cast<const QVariant *>(m_data[index + 1]);
+        return QVariant(type, m_data[index + 1]);
+    }
+
+    /**
+     * Return true if the argument at @p index can be converted to JSON without a QVariant.
+     */
+    bool hasJsonConverter(qsizetype index) const { return m_types.at(index).toJson; }
+
+    /**
+     * Return the argument at @p index as JSON. Requires hasJsonConverter() to be true.
+     */
+    QJsonValue toJson(qsizetype index) const
+    {
+        Q_ASSERT(hasJsonConverter(index));
+        return m_types.at(index).toJson(m_data[index + 1]);
+    }
+
+    /**
+     * Return all arguments as JSON array, as QJsonArray::fromVariantList would.
+     */
+    QJsonArray toJsonArray() const
+    {
+        QJsonArray array;
+        for (qsizetype i = 0; i < size(); ++i)
+            array.append(hasJsonConverter(i) ? toJson(i) : QJsonValue::fromVariant(value(i)));
+        return array;
+    }
+
+private:
+    // a copy, as the receiver may connect to further signals while the arguments are in use
+    SignalArgumentTypes m_types;
+    void **m_data;
+};
+
 /**
  * The signal handler is similar to QSignalSpy, but geared towards the usecase of the web channel.
  *
  * It allows connecting to any number of signals of arbitrary objects and forwards the signal
  * invocations to the Receiver by calling its signalEmitted function, which takes the object,
- * signal index and a QVariantList of arguments.
+ * signal index and the SignalArguments.
  */
 template<class Receiver>
 class SignalHandler : public QObject
@@ -76,7 +207,7 @@ private:
     /**
      * Exctract the arguments of a signal call and pass them to the receiver.
      *
-     * The @p argumentData is converted to a QVariantList and then passed to the receiver's
+     * The @p argumentData is wrapped in SignalArguments and then passed to the receiver's
      * signalEmitted method.
      */
     void dispatch(const QObject *object, const int signalIdx, void **argumentData);
@@ -85,11 +216,11 @@ private:
 
     Receiver *m_receiver;
 
-    // maps meta object -> signalIndex -> list of arguments
+    // maps (meta object, signalIndex) -> list of argument types, so that a single lookup per
+    // invocation finds them
     // NOTE: This data is "leaked" on disconnect until deletion of the handler, is this a problem?
-    typedef QList<int> ArgumentTypeList;
-    typedef QHash<int, ArgumentTypeList> SignalArgumentHash;
-    QHash<const QMetaObject *, SignalArgumentHash > m_signalArgumentTypes;
+    typedef QHash<std::pair<const QMetaObject *, int>, SignalArgumentTypes> SignalArgumentHash;
+    SignalArgumentHash m_signalArgumentTypes;
 
     /*
      * Tracks how many connections are active to object signals.
@@ -164,49 +295,24 @@ void SignalHandler<Receiver>::connectTo(const QObject *object, const int signalI
 template<class Receiver>
 void SignalHandler<Receiver>::setupSignalArgumentTypes(const QMetaObject *metaObject, const QMetaMethod &signal)
 {
-    if (m_signalArgumentTypes.value(metaObject).contains(signal.methodIndex())) {
+    const std::pair<const QMetaObject *, int> key(metaObject, signal.methodIndex());
+    if (m_signalArgumentTypes.contains(key)) {
         return;
     }
-    // find the type ids of the signal parameters, see also QSignalSpy::initArgs
-    QList<int> args;
-    args.reserve(signal.parameterCount());
-    for (int i = 0; i < signal.parameterCount(); ++i) {
-        int tp = signal.parameterType(i);
-        if (tp == QMetaType::UnknownType) {
-            qWarning("Don't know how to handle '%s', use qRegisterMetaType to register it.",
-                    signal.parameterNames().at(i).constData());
-        }
-        args << tp;
-    }
-
-    m_signalArgumentTypes[metaObject][signal.methodIndex()] = args;
+    m_signalArgumentTypes.insert(key, signalArgumentTypes(signal));
 }
 
 template<class Receiver>
 void SignalHandler<Receiver>::dispatch(const QObject *object, const int signalIdx, void **argumentData)
 {
-    Q_ASSERT(m_signalArgumentTypes.contains(object->metaObject()));
-    const QHash<int, QList<int>> &objectSignalArgumentTypes = m_signalArgumentTypes.value(object->metaObject());
-    QHash<int, QList<int>>::const_iterator signalIt = objectSignalArgumentTypes.constFind(signalIdx);
-    if (signalIt == objectSignalArgumentTypes.constEnd()) {
+    const SignalArgumentHash::const_iterator signalIt =
+            m_signalArgumentTypes.constFind({ object->metaObject(), signalIdx });
+    if (signalIt == m_signalArgumentTypes.constEnd()) {
         // not connected to this signal, skip
         return;
     }
-    const QList<int> &argumentTypes = *signalIt;
-    QVariantList arguments;
-    arguments.reserve(argumentTypes.size());
     // TODO: basic overload resolution based on number of arguments?
-    for (int i = 0; i < argumentTypes.size(); ++i) {
-        const QMetaType::Type type = static_cast<QMetaType::Type>(argumentTypes.at(i));
-        QVariant arg;
-        if (type == QMetaType::QVariant) {
-            arg = *reinterpret_cast<QVariant *>(argumentData[i + 1]);
-        } else {
-            arg = QVariant(QMetaType(type), argumentData[i + 1]);
-        }
-        arguments.append(arg);
-    }
-    m_receiver->signalEmitted(object, signalIdx, arguments);
+    m_receiver->signalEmitted(object, signalIdx, SignalArguments(*signalIt, argumentData));
 }
 
 template<class Receiver>
@@ -255,9 +361,9 @@ void SignalHandler<Receiver>::clear()
         for (const ConnectionPair &connection : connections)
             QObject::disconnect(connection.first);
     }
-    const SignalArgumentHash keep = m_signalArgumentTypes.take(&QObject::staticMetaObject);
-    m_signalArgumentTypes.clear();
-    m_signalArgumentTypes[&QObject::staticMetaObject] = keep;
+    m_signalArgumentTypes.removeIf([](SignalArgumentHash::iterator it) {
+        return it.key().first != &QObject::staticMetaObject;
+    });
 }
 
 template<class Receiver>
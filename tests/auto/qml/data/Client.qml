@@ -48,9 +48,9 @@ Item {
     }
     readonly property var clientTransport: clientTransport
 
-    function createChannel(callback, raw)
+    function createChannel(callback, raw, options)
     {
-        return new JSClient.QWebChannel(clientTransport, callback, raw);
+        return new JSClient.QWebChannel(clientTransport, callback, raw, options);
     }
 
     function cleanup()
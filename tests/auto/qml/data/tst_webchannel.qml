@@ -138,6 +138,68 @@ TestCase {
         compare(channel.objects.myObj.myProperty, 2)
     }
 
+    function test_compactUpdates()
+    {
+        var changedValue;
+        var channel = client.createChannel(function(channel) {
+            channel.objects.myObj.myPropertyChanged.connect(function() {
+                changedValue = channel.objects.myObj.myProperty;
+            });
+        }, undefined, {compactUpdates: true});
+
+        var init = client.awaitInit();
+        compare(init.capabilities, {compactUpdates: true});
+        client.awaitIdle(); // init
+        compare(channel.capabilities.compactUpdates, true);
+
+        myObj.myProperty = 2;
+        client.awaitIdle(); // property update
+        compare(changedValue, 2);
+        compare(channel.objects.myObj.myProperty, 2);
+
+        var update = client.serverMessages.filter(function(message) {
+            return message.type === JSClient.QWebChannelMessageTypes.propertyUpdate;
+        }).pop();
+        verify(update);
+        var objectUpdate = update.data[0];
+        compare(objectUpdate.object, "myObj");
+        verify(Array.isArray(objectUpdate.properties));
+        verify(Array.isArray(objectUpdate.signals));
+        // [index, value] for the single property and [index, arguments] for its notify signal
+        compare(objectUpdate.properties.length, 2);
+        compare(objectUpdate.properties[1], 2);
+        compare(objectUpdate.signals.length, 2);
+    }
+
+    function test_propertyInterest()
+    {
+        var channel = client.createChannel(function(channel) {}, undefined, {propertyInterest: true});
+
+        var init = client.awaitInit();
+        compare(init.capabilities, {propertyInterest: true});
+        client.awaitIdle(); // init
+
+        // the first read declares the interest in the property
+        compare(channel.objects.myObj.myProperty, myObj.myProperty);
+        var observe = client.await(JSClient.QWebChannelMessageTypes.observeProperties);
+        compare(observe.object, "myObj");
+        compare(observe.properties.length, 1);
+        client.awaitIdle(); // current value
+
+        myObj.myProperty = 3;
+        myOtherObj.foo = 3;
+        client.awaitIdle(); // property update
+        compare(channel.objects.myObj.myProperty, 3);
+
+        // properties that were never read are not updated
+        var update = client.serverMessages.filter(function(message) {
+            return message.type === JSClient.QWebChannelMessageTypes.propertyUpdate;
+        }).pop();
+        verify(update);
+        compare(update.data.length, 1);
+        compare(update.data[0].object, "myObj");
+    }
+
     function test_bindableProperty()
     {
         compare(testObject.stringProperty, "foo");
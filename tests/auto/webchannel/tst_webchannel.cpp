@@ -7,6 +7,7 @@
 #include <QtWebChannel/qwebchannel.h>
 #include <QtWebChannel/private/qwebchannel_p.h>
 #include <QtWebChannel/private/qmetaobjectpublisher_p.h>
+#include <QtCore/private/qobject_p.h>
 
 #include <QtTest>
 #include <QtTest/private/qpropertytesthelper_p.h>
@@ -15,12 +16,15 @@
 #endif
 
 #include <QPromise>
+#include <QtEndian>
 #include <QTimer>
+#include <QUuid>
 
 #ifdef WEBCHANNEL_TESTS_CAN_USE_CONCURRENT
 #include <QtConcurrent>
 #endif
 
+#include <limits>
 #include <memory>
 #include <optional>
 #include <vector>
@@ -183,6 +187,17 @@ QVariantList convert_to_js(const TestStructVector &list)
     });
     return ret;
 }
+
+// A meta object per instance, as QML objects have them. It has the methods of TestObject.
+struct InstanceMetaObject : QAbstractDynamicMetaObject
+{
+    InstanceMetaObject() { d = TestObject::staticMetaObject.d; }
+
+    int metaCall(QObject *object, QMetaObject::Call call, int id, void **arguments) override
+    {
+        return object->qt_metacall(call, id, arguments);
+    }
+};
 }
 
 #if QT_CONFIG(future)
@@ -511,6 +526,8 @@ void TestWebChannel::testInfoForObject()
         addMethod(QStringLiteral("replay"), "replay()");
         addMethod(QStringLiteral("overloadSignal"), "overloadSignal(int)");
         addMethod(QStringLiteral("overloadSignal"), "overloadSignal(float)", false);
+        addMethod(QStringLiteral("argumentsSignal"),
+                  "argumentsSignal(int,double,bool,QString,QByteArray,QStringList,QVariant)");
         QCOMPARE(info["signals"].toArray(), expected);
     }
 
@@ -620,6 +637,185 @@ void TestWebChannel::testInfoForObject()
     }
 }
 
+void TestWebChannel::testInfoForObjectCache()
+{
+    TestObject obj1;
+    TestObject obj2;
+    obj1.setProp("foo");
+    obj2.setProp("bar");
+
+    QWebChannel channel;
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    const QJsonObject info1 = publisher->classInfoForObject(&obj1, m_dummyTransport);
+    const QJsonObject info2 = publisher->classInfoForObject(&obj2, m_dummyTransport);
+
+    // the class information is reflected only once per meta object
+    QCOMPARE(publisher->classDescriptors.size(), 1);
+    QVERIFY(publisher->classDescriptors.contains(&TestObject::staticMetaObject));
+
+    QCOMPARE(info1["signals"], info2["signals"]);
+    QCOMPARE(info1["methods"], info2["methods"]);
+    QCOMPARE(info1["enums"], info2["enums"]);
+
+    // but the property values are read per object
+    const int propIndex = obj1.metaObject()->indexOfProperty("prop");
+    QCOMPARE(info1["properties"].toArray()[propIndex].toArray()[3].toString(), obj1.prop());
+    QCOMPARE(info2["properties"].toArray()[propIndex].toArray()[3].toString(), obj2.prop());
+}
+
+void TestWebChannel::testTypeDescriptors()
+{
+    QWebChannel channel;
+    TestObject obj1;
+    TestObject obj2;
+    obj1.setProp("foo");
+    obj2.setProp("bar");
+    channel.registerObject("obj1", &obj1);
+    channel.registerObject("obj2", &obj2);
+
+    EncodingTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "typeDescriptors", true } } },
+        }, &transport);
+
+    QCOMPARE(transport.encodedMessagesSent().size(), 1);
+    const QJsonObject response =
+            QJsonDocument::fromJson(transport.encodedMessagesSent().first()).object();
+    QCOMPARE(response["capabilities"].toObject(), (QJsonObject{ { "typeDescriptors", true } }));
+
+    // both objects share a single type descriptor
+    const QJsonObject types = response["types"].toObject();
+    QCOMPARE(types.size(), 1);
+    const QJsonObject type = types.begin().value().toObject();
+    QVERIFY(!type["signals"].toArray().isEmpty());
+    QVERIFY(!type["methods"].toArray().isEmpty());
+    QVERIFY(!type["enums"].toObject().isEmpty());
+    const int propIndex = obj1.metaObject()->indexOfProperty("prop");
+    const QJsonArray propInfo = type["properties"].toArray()[propIndex].toArray();
+    QCOMPARE(propInfo.size(), 3);
+    QCOMPARE(propInfo[1].toString(), QStringLiteral("prop"));
+
+    // and only carry their property values
+    const QJsonObject info1 = response["data"].toObject()["obj1"].toObject();
+    const QJsonObject info2 = response["data"].toObject()["obj2"].toObject();
+    QCOMPARE(info1.keys(), QStringList({ "type", "values" }));
+    QCOMPARE(info1["type"], info2["type"]);
+    QCOMPARE(QString::number(info1["type"].toInt()), types.begin().key());
+    QCOMPARE(info1["values"].toArray()[propIndex].toString(), obj1.prop());
+    QCOMPARE(info2["values"].toArray()[propIndex].toString(), obj2.prop());
+
+    // types are only sent once per client
+    TestObject obj3;
+    const QJsonObject wrapped =
+            publisher->wrapResult(QVariant::fromValue(&obj3), &transport).toObject();
+    QCOMPARE(wrapped["data"].toObject()["type"], info1["type"]);
+    QJsonObject wrappedResponse;
+    publisher->attachPendingTypes(wrappedResponse, &transport);
+    QVERIFY(!wrappedResponse.contains("types"));
+
+    QObject plainObject;
+    publisher->wrapResult(QVariant::fromValue(&plainObject), &transport);
+    publisher->attachPendingTypes(wrappedResponse, &transport);
+    QCOMPARE(wrappedResponse["types"].toObject().size(), 1);
+
+#ifdef WEBCHANNEL_TESTS_CAN_USE_JS_ENGINE
+    TestJSEngine engine;
+    channel.connectTo(engine.transport());
+    QSignalSpy spy(&engine, &TestJSEngine::channelSetupReady);
+    engine.globalObject().setProperty(QStringLiteral("channel"), engine.newObject());
+    QJSValue jsChannel = engine.evaluate(QStringLiteral(
+            "channel = new QWebChannel(transport, function(channel) { transport.channelSetupReady(); },"
+            "                          undefined, { typeDescriptors: true });"));
+    QVERIFY(!jsChannel.isError());
+    if (!spy.size())
+        spy.wait();
+    QCOMPARE(spy.size(), 1);
+
+    QCOMPARE(engine.evaluate("channel.objects.obj1.prop").toString(), obj1.prop());
+    QCOMPARE(engine.evaluate("channel.objects.obj2.prop").toString(), obj2.prop());
+    QCOMPARE(engine.evaluate("typeof channel.objects.obj2.method1").toString(),
+             QStringLiteral("function"));
+    QCOMPARE(engine.evaluate("channel.objects.obj2.Foo.Asdf").toInt(), int(TestObject::Asdf));
+    QCOMPARE(engine.logger()->errorCount(), 0);
+#endif // WEBCHANNEL_TESTS_CAN_USE_JS_ENGINE
+}
+
+void TestWebChannel::testLazyInit()
+{
+    QWebChannel channel;
+    TestObject obj1;
+    TestObject obj2;
+    obj1.setProp("foo");
+    channel.registerObject("obj1", &obj1);
+    channel.registerObject("obj2", &obj2);
+
+    EncodingTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "lazyInit", true } } },
+        }, &transport);
+
+    // the init response only lists the object ids
+    QCOMPARE(transport.encodedMessagesSent().size(), 1);
+    QJsonObject response = QJsonDocument::fromJson(transport.encodedMessagesSent().last()).object();
+    QStringList ids;
+    for (const QJsonValue &id : response["data"].toArray())
+        ids << id.toString();
+    ids.sort();
+    QCOMPARE(ids, QStringList({ "obj1", "obj2" }));
+
+    // the class info is requested per object
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeObjectInfo },
+            { "id", 2 },
+            { "object", "obj1" },
+        }, &transport);
+    QCOMPARE(transport.encodedMessagesSent().size(), 2);
+    response = QJsonDocument::fromJson(transport.encodedMessagesSent().last()).object();
+    QCOMPARE(response["type"].toInt(), int(TypeResponse));
+    QCOMPARE(response["id"].toInt(), 2);
+    QCOMPARE(response["data"].toObject(), publisher->classInfoForObject(&obj1, &transport));
+
+    // property updates are sent for objects which were not requested yet
+    publisher->handleMessage(QJsonObject{ { "type", TypeIdle } }, &transport);
+    obj2.setProp("bar");
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(transport.encodedMessagesSent().size(), 3);
+    response = QJsonDocument::fromJson(transport.encodedMessagesSent().last()).object();
+    QCOMPARE(response["type"].toInt(), int(TypePropertyUpdate));
+    QCOMPARE(response["data"].toArray().first().toObject()["object"].toString(),
+             QStringLiteral("obj2"));
+
+#ifdef WEBCHANNEL_TESTS_CAN_USE_JS_ENGINE
+    TestJSEngine engine;
+    channel.connectTo(engine.transport());
+    QSignalSpy spy(&engine, &TestJSEngine::channelSetupReady);
+    engine.globalObject().setProperty(QStringLiteral("channel"), engine.newObject());
+    QJSValue jsChannel = engine.evaluate(QStringLiteral(
+            "channel = new QWebChannel(transport, function(channel) { transport.channelSetupReady(); },"
+            "                          undefined, { lazyInit: true });"));
+    QVERIFY(!jsChannel.isError());
+    if (!spy.size())
+        spy.wait();
+    QCOMPARE(spy.size(), 1);
+
+    QVERIFY(engine.evaluate("channel.objects.obj1 === undefined").toBool());
+    QJSValue loaded = engine.evaluate(
+            "var loadedProp; channel.loadObject('obj1', function(obj) { loadedProp = obj.prop; });");
+    QVERIFY(!loaded.isError());
+    QTRY_COMPARE(engine.evaluate("loadedProp").toString(), obj1.prop());
+    QVERIFY(engine.evaluate("channel.objects.obj2 === undefined").toBool());
+    QCOMPARE(engine.logger()->errorCount(), 0);
+#endif // WEBCHANNEL_TESTS_CAN_USE_JS_ENGINE
+}
+
 void TestWebChannel::testInvokeMethodConversion()
 {
     QWebChannel channel;
@@ -631,6 +827,11 @@ void TestWebChannel::testInvokeMethodConversion()
     {
         channel.d_func()->publisher->invokeMethod(this, "setInt", args);
         QCOMPARE(m_lastInt, args.at(0).toInt());
+        // the invoker of the method is reused for further calls
+        const size_t invokers = channel.d_func()->publisher->methodInvokers.size();
+        channel.d_func()->publisher->invokeMethod(this, "setInt", args);
+        QCOMPARE(m_lastInt, args.at(0).toInt());
+        QCOMPARE(channel.d_func()->publisher->methodInvokers.size(), invokers);
         int getterMethod = metaObject()->indexOfMethod("readInt()");
         QVERIFY(getterMethod != -1);
         auto retVal = channel.d_func()->publisher->invokeMethod(this, getterMethod, {});
@@ -833,6 +1034,53 @@ void TestWebChannel::testInvokeMethodOverloadResolution()
         result = publisher->invokeMethod(&testObject, "overload", args);
         QCOMPARE(result.toString(), QStringLiteral("42foobar"));
     }
+    {
+        // the resolution is reused for calls with the same kinds of arguments
+        const qsizetype resolutions = publisher->overloadResolutions.size();
+        result = publisher->invokeMethod(&testObject, "overload", { "again" });
+        QCOMPARE(result.toString(), QStringLiteral("AGAIN"));
+        result = publisher->invokeMethod(&testObject, "overload", { 1.5 });
+        QCOMPARE(result.toDouble(), 2.5);
+        QCOMPARE(publisher->overloadResolutions.size(), resolutions);
+    }
+    {
+        // methods that do not exist are not cached
+        const qsizetype resolutions = publisher->overloadResolutions.size();
+        QTest::ignoreMessage(QtWarningMsg, QRegularExpression("No candidates found for"));
+        publisher->invokeMethod(&testObject, "doesNotExist", { 1 });
+        QCOMPARE(publisher->overloadResolutions.size(), resolutions);
+    }
+    {
+        // other objects may have an id as well, which is not an object to look up
+        QTest::failOnWarning(QRegularExpression("No wrapped object"));
+        const QJsonObject object{ { "id", "foo" }, { "name", "bar" } };
+        publisher->invokeMethod(this, "setJsonObject", { object });
+        QCOMPARE(m_lastJsonObject, object);
+    }
+}
+
+void TestWebChannel::testInvokeMethodDynamicMetaObject()
+{
+    QWebChannel channel;
+    channel.connectTo(m_dummyTransport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+
+    const size_t invokers = publisher->methodInvokers.size();
+    const qsizetype resolutions = publisher->overloadResolutions.size();
+    for (int i = 0; i < 3; ++i) {
+        TestObject testObject;
+        QObjectPrivate::get(&testObject)->metaObject = new InstanceMetaObject;
+        QVERIFY(testObject.metaObject() != &TestObject::staticMetaObject);
+
+        const QVariant result = publisher->invokeMethod(&testObject, "overload", { 41.0 });
+        QCOMPARE(result.toDouble(), 42.0);
+        const int method = testObject.metaObject()->indexOfMethod("setProp(QString)");
+        publisher->invokeMethod(&testObject, method, { "foo" });
+        QCOMPARE(testObject.prop(), QStringLiteral("foo"));
+    }
+    // the meta objects are gone along with their objects, so nothing is cached for them
+    QCOMPARE(publisher->methodInvokers.size(), invokers);
+    QCOMPARE(publisher->overloadResolutions.size(), resolutions);
 }
 
 void TestWebChannel::testDisconnect()
@@ -843,6 +1091,938 @@ void TestWebChannel::testDisconnect()
     m_dummyTransport->emitMessageReceived(QJsonObject());
 }
 
+void TestWebChannel::testSignalSubscriptions()
+{
+    QWebChannel channel;
+    TestObject obj;
+    auto *temporaryObj = new TestObject;
+    channel.registerObject("testObject", &obj);
+    channel.registerObject("temporaryObject", temporaryObj);
+
+    DummyTransport subscriber;
+    DummyTransport other;
+    channel.connectTo(&subscriber);
+    channel.connectTo(&other);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&subscriber);
+    publisher->initializeClient(&other);
+
+    const int signalIndex = obj.metaObject()->indexOfSignal("sig1()");
+    const QJsonObject connectMessage = {
+        { "type", TypeConnectToSignal },
+        { "object", "testObject" },
+        { "signal", signalIndex },
+    };
+    QJsonObject disconnectMessage = connectMessage;
+    disconnectMessage["type"] = TypeDisconnectFromSignal;
+
+    // signals are only sent to connected clients
+    publisher->handleMessage(connectMessage, &subscriber);
+    publisher->handleMessage(connectMessage, &subscriber);
+    emit obj.sig1();
+    QCOMPARE(subscriber.messagesSent().size(), 1);
+    QCOMPARE(subscriber.messagesSent().last()["type"].toInt(), int(TypeSignal));
+    QCOMPARE(subscriber.messagesSent().last()["signal"].toInt(), signalIndex);
+    QVERIFY(other.messagesSent().isEmpty());
+
+    // connections are counted per client
+    publisher->handleMessage(disconnectMessage, &subscriber);
+    emit obj.sig1();
+    QCOMPARE(subscriber.messagesSent().size(), 2);
+    publisher->handleMessage(disconnectMessage, &subscriber);
+    emit obj.sig1();
+    QCOMPARE(subscriber.messagesSent().size(), 2);
+    QVERIFY(other.messagesSent().isEmpty());
+    QVERIFY(publisher->signalSubscriptions.isEmpty());
+
+    // removing a transport drops its connections
+    publisher->handleMessage(connectMessage, &other);
+    QVERIFY(!publisher->signalSubscriptions.isEmpty());
+    channel.disconnectFrom(&other);
+    QVERIFY(publisher->signalSubscriptions.isEmpty());
+    emit obj.sig1();
+    QVERIFY(other.messagesSent().isEmpty());
+    QCOMPARE(subscriber.messagesSent().size(), 2);
+
+    // the destroyed signal is always sent
+    channel.connectTo(&other);
+    delete temporaryObj;
+    QCOMPARE(subscriber.messagesSent().size(), 3);
+    QCOMPARE(subscriber.messagesSent().last()["object"].toString(), QStringLiteral("temporaryObject"));
+    QCOMPARE(other.messagesSent().size(), 1);
+}
+
+void TestWebChannel::testSignalArguments()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&transport);
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeConnectToSignal },
+            { "object", "testObject" },
+            { "signal", obj.metaObject()->indexOfSignal(
+                    "argumentsSignal(int,double,bool,QString,QByteArray,QStringList,QVariant)") },
+        }, &transport);
+
+    // primitive arguments are converted directly, others like any other value
+    emit obj.argumentsSignal(42, 1.5, true, QStringLiteral("foo"), QByteArrayLiteral("bar"),
+                             QStringList{ "a", "b" }, QVariant::fromValue(QVariantList{ 1, "c" }));
+    QCOMPARE(transport.messagesSent().size(), 1);
+    const QJsonArray expected = {
+        42, 1.5, true, "foo", "bar", QJsonArray{ "a", "b" }, QJsonArray{ 1, "c" },
+    };
+    QCOMPARE(transport.messagesSent().last()["args"].toArray(), expected);
+
+    // with the same result as wrapResult, also for values JSON cannot represent
+    for (const double d : { qQNaN(), qInf(), -qInf() }) {
+        for (const QByteArray &bytes : { QByteArray(), QByteArrayLiteral("\xff\xfe") }) {
+            emit obj.argumentsSignal(0, d, false, QString(), bytes, QStringList(), QVariant());
+            const QJsonArray args = transport.messagesSent().last()["args"].toArray();
+            QCOMPARE(args.at(1), publisher->wrapResult(d, &transport));
+            QCOMPARE(args.at(4), publisher->wrapResult(bytes, &transport));
+        }
+    }
+}
+
+void TestWebChannel::testPendingPropertyUpdates()
+{
+    QWebChannel channel;
+    TestObject obj;
+    auto *temporaryObj = new TestObject;
+    channel.registerObject("testObject", &obj);
+    channel.registerObject("temporaryObject", temporaryObj);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&transport);
+
+    // changes are collected per object
+    obj.setProp("foo");
+    obj.setProp("bar");
+    obj.setStringProperty("baz");
+    temporaryObj->setProp("foo");
+    QCOMPARE(publisher->dirtyObjectSlots.size(), 2);
+    const qsizetype slot = publisher->dirtyObjectSlots.first();
+    const auto &update = publisher->pendingPropertyUpdates.at(slot);
+    QVERIFY(update.properties.testBit(obj.metaObject()->indexOfProperty("prop")));
+    QVERIFY(update.properties.testBit(obj.metaObject()->indexOfProperty("stringProperty")));
+    QCOMPARE(update.properties.count(true), 2);
+    QCOMPARE(update.signalArguments.size(), 1);
+    QCOMPARE(update.signalArguments.first().second, QJsonArray{ "bar" });
+
+    // and dropped along with destroyed objects
+    delete temporaryObj;
+    QCOMPARE(publisher->dirtyObjectSlots, QList<qsizetype>{ slot });
+
+    publisher->setClientIsIdle(true, &transport);
+    publisher->sendPendingPropertyUpdates();
+    QVERIFY(publisher->dirtyObjectSlots.isEmpty());
+    const QJsonArray updates = transport.messagesSent().last()["data"].toArray();
+    QCOMPARE(updates.size(), 1);
+    QCOMPARE(updates.first()["object"].toString(), QStringLiteral("testObject"));
+}
+
+void TestWebChannel::testPropertyUpdateWiring()
+{
+    QWebChannel channel;
+    TestObject obj1;
+    TestObject obj2;
+    channel.registerObject("obj1", &obj1);
+    channel.registerObject("obj2", &obj2);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&transport);
+
+    // the notify wiring is taken from the class and shared by all its objects
+    const QMetaObject *metaObject = obj1.metaObject();
+    const auto &descriptor = publisher->classDescriptor(&obj1);
+    const int propIndex = metaObject->indexOfProperty("prop");
+    const int notifyIndex = metaObject->property(propIndex).notifySignalIndex();
+    QVERIFY(descriptor.notifySignals.value(notifyIndex).testBit(propIndex));
+    QVERIFY(descriptor.bindableProperties.contains(metaObject->indexOfProperty("stringProperty")));
+    QVERIFY(publisher->signalToPropertyMap.value(&obj1).isSharedWith(
+                publisher->signalToPropertyMap.value(&obj2)));
+
+    // initializing the object again does not connect twice
+    publisher->initializePropertyUpdates(&obj1, descriptor);
+    obj1.setProp("foo");
+    obj1.setStringProperty("bar");
+    const qsizetype slot = publisher->dirtyObjectSlots.first();
+    QCOMPARE(publisher->dirtyObjectSlots.size(), 1);
+    QCOMPARE(publisher->pendingPropertyUpdates.at(slot).signalArguments.size(), 1);
+    QCOMPARE(publisher->pendingPropertyUpdates.at(slot).properties.count(true), 2);
+}
+
+void TestWebChannel::testClassInfoSentOnce()
+{
+    QWebChannel channel;
+    TestObject obj;
+    TestObject child;
+    obj.setObjectProperty(&child);
+    channel.registerObject("testObject", &obj);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&transport);
+    publisher->setClientIsIdle(true, &transport);
+
+    const QString propIndex = QString::number(obj.metaObject()->indexOfProperty("objectProperty"));
+    auto sentObjectProperty = [&]() {
+        obj.setObjectProperty(&child);
+        publisher->sendPendingPropertyUpdates();
+        const QJsonArray updates = transport.messagesSent().last()["data"].toArray();
+        return updates.first()["properties"].toObject()[propIndex].toObject();
+    };
+
+    // the client got the class information of the child when it was initialized
+    const QString childId = publisher->registeredObjectIds.value(&child);
+    const QJsonObject reference{ { "__QObject*__", true }, { "id", childId } };
+    QCOMPARE(sentObjectProperty(), reference);
+
+    // it is sent again as long as one of the recipients does not know the child
+    DummyTransport other;
+    channel.connectTo(&other);
+    publisher->setClientIsIdle(true, &transport);
+    publisher->setClientIsIdle(true, &other);
+    QVERIFY(sentObjectProperty().contains("data"));
+    publisher->setClientIsIdle(true, &transport);
+    publisher->setClientIsIdle(true, &other);
+    QCOMPARE(sentObjectProperty(), reference);
+}
+
+void TestWebChannel::testClassInfoOfQueuedUpdates()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    // a busy client whose updates are merged, and one whose oldest update is dropped
+    DummyTransport compact;
+    DummyTransport dropping;
+    channel.connectTo(&compact);
+    channel.connectTo(&dropping);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "compactUpdates", true } } },
+        }, &compact);
+    publisher->initializeClient(&dropping);
+    channel.setQueueLimits(&dropping, 1, 0, QWebChannel::DropOldestMessages);
+
+    // a new object is sent twice before the clients receive any of the updates, a message in
+    // between keeps the updates of the dropping client from being merged
+    TestObject child;
+    obj.setObjectProperty(&child);
+    publisher->sendPendingPropertyUpdates();
+    publisher->enqueueMessage(QJsonObject{ { "type", TypeSignal } }, &dropping);
+    emit obj.objectPropertyChanged();
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(publisher->transportState[&compact].queuedMessages.size(), 1);
+    QCOMPARE(publisher->transportState[&dropping].queuedMessages.size(), 1);
+
+    // the remaining update still describes it, as the clients did not receive it before
+    const int propIndex = obj.metaObject()->indexOfProperty("objectProperty");
+    publisher->setClientIsIdle(true, &compact);
+    const QJsonArray compactProperties = compact.messagesSent().last()["data"].toArray()
+            .first()["properties"].toArray();
+    QCOMPARE(compactProperties.size(), 2);
+    QCOMPARE(compactProperties[0].toInt(), propIndex);
+    QVERIFY(compactProperties[1].toObject().contains("data"));
+    publisher->setClientIsIdle(true, &dropping);
+    const QJsonObject droppingProperties = dropping.messagesSent().last()["data"].toArray()
+            .first()["properties"].toObject();
+    QVERIFY(droppingProperties[QString::number(propIndex)].toObject().contains("data"));
+
+    // once delivered, the clients know it
+    publisher->setClientIsIdle(true, &compact);
+    publisher->setClientIsIdle(true, &dropping);
+    emit obj.objectPropertyChanged();
+    publisher->sendPendingPropertyUpdates();
+    const QJsonArray properties = compact.messagesSent().last()["data"].toArray()
+            .first()["properties"].toArray();
+    QVERIFY(!properties[1].toObject().contains("data"));
+    const QJsonObject otherProperties = dropping.messagesSent().last()["data"].toArray()
+            .first()["properties"].toObject();
+    QVERIFY(!otherProperties[QString::number(propIndex)].toObject().contains("data"));
+}
+
+void TestWebChannel::testPropertyInterest()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    DummyTransport interested;
+    DummyTransport legacy;
+    channel.connectTo(&interested);
+    channel.connectTo(&legacy);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "propertyInterest", true } } },
+        }, &interested);
+    publisher->initializeClient(&legacy);
+    QCOMPARE(interested.messagesSent().size(), 1);
+    QCOMPARE(interested.messagesSent().first()["capabilities"].toObject(),
+             (QJsonObject{ { "propertyInterest", true } }));
+    publisher->setClientIsIdle(true, &interested);
+    publisher->setClientIsIdle(true, &legacy);
+
+    // nothing is sent before the client declared its interest
+    obj.setProp("foo");
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(interested.messagesSent().size(), 1);
+    QCOMPARE(legacy.messagesSent().size(), 1);
+    publisher->setClientIsIdle(true, &legacy);
+
+    // observing a property sends its current value
+    const int propIndex = obj.metaObject()->indexOfProperty("prop");
+    const int barIndex = obj.metaObject()->indexOfProperty("bar");
+    QJsonObject observeMessage = {
+        { "type", TypeObserveProperties },
+        { "object", "testObject" },
+        { "properties", QJsonArray{ propIndex } },
+    };
+    publisher->handleMessage(observeMessage, &interested);
+    QCOMPARE(interested.messagesSent().size(), 2);
+    QJsonObject update = interested.messagesSent().last()["data"].toArray().first().toObject();
+    QCOMPARE(update["properties"].toObject(),
+             (QJsonObject{ { QString::number(propIndex), "foo" } }));
+    publisher->setClientIsIdle(true, &interested);
+
+    // only the observed properties and their notify signals are sent to the client
+    obj.setProp("bar");
+    emit obj.theBarHasChanged();
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(interested.messagesSent().size(), 3);
+    update = interested.messagesSent().last()["data"].toArray().first().toObject();
+    QCOMPARE(update["properties"].toObject().keys(), QStringList{ QString::number(propIndex) });
+    QCOMPARE(update["signals"].toObject().size(), 1);
+    QCOMPARE(legacy.messagesSent().size(), 2);
+    update = legacy.messagesSent().last()["data"].toArray().first().toObject();
+    QCOMPARE(update["properties"].toObject().size(), 2);
+    QVERIFY(update["properties"].toObject().contains(QString::number(barIndex)));
+    publisher->setClientIsIdle(true, &interested);
+    publisher->setClientIsIdle(true, &legacy);
+
+    // and nothing once the client lost interest
+    observeMessage["observe"] = false;
+    publisher->handleMessage(observeMessage, &interested);
+    QVERIFY(publisher->transportState[&interested].observedProperties.isEmpty());
+    obj.setProp("baz");
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(interested.messagesSent().size(), 3);
+    QCOMPARE(legacy.messagesSent().size(), 3);
+}
+
+void TestWebChannel::testCreditFlowControl()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "credits", 2 } } },
+        }, &transport);
+    QCOMPARE(transport.messagesSent().size(), 1);
+    QCOMPARE(transport.messagesSent().first()["capabilities"].toObject(),
+             (QJsonObject{ { "credits", 2 } }));
+    QVERIFY(!publisher->isClientIdle(&transport));
+
+    // the granted credits are capped at the window
+    publisher->handleMessage(QJsonObject{ { "type", TypeIdle }, { "credits", 5 } }, &transport);
+    QCOMPARE(publisher->transportState[&transport].credits, 2);
+
+    // one update is sent per credit without waiting for an acknowledgement
+    for (const QString &value : QStringList{ "a", "b", "c" }) {
+        obj.setProp(value);
+        publisher->sendPendingPropertyUpdates();
+    }
+    QCOMPARE(transport.messagesSent().size(), 3);
+    QVERIFY(!publisher->isClientIdle(&transport));
+    QCOMPARE(publisher->transportState[&transport].queuedMessages.size(), 1);
+
+    publisher->handleMessage(QJsonObject{ { "type", TypeIdle }, { "credits", 1 } }, &transport);
+    QCOMPARE(transport.messagesSent().size(), 4);
+    const QJsonObject update = transport.messagesSent().last()["data"].toArray().first().toObject();
+    QCOMPARE(update["properties"].toObject().begin().value().toString(), QStringLiteral("c"));
+    QVERIFY(publisher->transportState[&transport].queuedMessages.isEmpty());
+
+    // the window cannot exceed the maximum
+    DummyTransport greedy;
+    channel.connectTo(&greedy);
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "credits", 100000 } } },
+        }, &greedy);
+    QCOMPARE(greedy.messagesSent().first()["capabilities"].toObject()["credits"].toInt(), 64);
+}
+
+void TestWebChannel::testCoalescedUpdates()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "compactUpdates", true } } },
+        }, &transport);
+    QCOMPARE(transport.messagesSent().size(), 1);
+    DummyTransport plain;
+    channel.connectTo(&plain);
+    publisher->initializeClient(&plain);
+
+    // updates for a busy client are merged into a single one
+    obj.setProp("a");
+    emit obj.theBarHasChanged();
+    publisher->sendPendingPropertyUpdates();
+    obj.setProp("b");
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(publisher->transportState[&transport].queuedMessages.size(), 1);
+    QCOMPARE(publisher->transportState[&plain].queuedMessages.size(), 1);
+
+    publisher->setClientIsIdle(true, &transport);
+    QCOMPARE(transport.messagesSent().size(), 2);
+    const QJsonArray data = transport.messagesSent().last()["data"].toArray();
+    QCOMPARE(data.size(), 1);
+    const QJsonObject update = data.first().toObject();
+    const int propIndex = obj.metaObject()->indexOfProperty("prop");
+    const int barIndex = obj.metaObject()->indexOfProperty("bar");
+    const QJsonArray properties = update["properties"].toArray();
+    QCOMPARE(properties.size(), 4);
+    QJsonObject values;
+    for (qsizetype i = 0; i + 1 < properties.size(); i += 2)
+        values[QString::number(properties[i].toInt())] = properties[i + 1];
+    QCOMPARE(values[QString::number(propIndex)].toString(), QStringLiteral("b"));
+    QVERIFY(values.contains(QString::number(barIndex)));
+
+    // with the latest arguments of the signals in the order of their last emission
+    const QJsonArray sigs = update["signals"].toArray();
+    QCOMPARE(sigs.size(), 4);
+    QCOMPARE(sigs[0].toInt(), obj.metaObject()->indexOfSignal("theBarHasChanged()"));
+    QCOMPARE(sigs[2].toInt(), obj.metaObject()->indexOfSignal("propChanged(QString)"));
+    QCOMPARE(sigs[3].toArray(), QJsonArray{ "b" });
+
+    // other clients get the merged update in the format they expect, keyed by the indexes
+    publisher->setClientIsIdle(true, &plain);
+    const QJsonObject plainUpdate = plain.messagesSent().last()["data"].toArray()
+            .first().toObject();
+    const QJsonObject plainProperties = plainUpdate["properties"].toObject();
+    QCOMPARE(plainProperties.size(), 2);
+    QCOMPARE(plainProperties[QString::number(propIndex)].toString(), QStringLiteral("b"));
+    const QJsonObject plainSigs = plainUpdate["signals"].toObject();
+    QCOMPARE(plainSigs.size(), 2);
+    QCOMPARE(plainSigs[QString::number(obj.metaObject()->indexOfSignal("propChanged(QString)"))]
+                     .toArray(),
+             QJsonArray{ "b" });
+}
+
+void TestWebChannel::testQueueLimits()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+    QSignalSpy spy(&channel, &QWebChannel::queueLimitReached);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&transport);
+    const auto queue = [&]() { return publisher->transportState[&transport].queuedMessages; };
+    // consecutive updates are merged anyway, so other messages make the queues grow
+    const auto queueUpdates = [&](const QStringList &values) {
+        for (const QString &value : values) {
+            obj.setProp(value);
+            publisher->sendPendingPropertyUpdates();
+            for (auto *queued : std::as_const(channel.d_func()->transports))
+                publisher->enqueueMessage(QJsonObject{ { "type", TypeSignal } }, queued);
+        }
+    };
+
+    // updates of a busy client are merged into a single one with the latest values
+    channel.setQueueLimits(&transport, 3, 0, QWebChannel::CoalesceMessages);
+    queueUpdates({ "a", "b" });
+    // the signal is emitted once control returns to the event loop
+    QCOMPARE(spy.size(), 0);
+    QTRY_COMPARE(spy.size(), 1);
+    QCOMPARE(spy.first().at(0).value<QWebChannelAbstractTransport *>(), &transport);
+    QCOMPARE(spy.first().at(1).value<QWebChannel::QueueOverflowPolicy>(),
+             QWebChannel::CoalesceMessages);
+    QCOMPARE(queue().size(), 3);
+    publisher->setClientIsIdle(true, &transport);
+    QCOMPARE(transport.messagesSent().size(), 3);
+    QJsonObject update = transport.messagesSent().last()["data"].toArray().first().toObject();
+    QCOMPARE(update["properties"].toObject().begin().value().toString(), QStringLiteral("b"));
+    QCOMPARE(update["signals"].toObject().size(), 1);
+
+    // the oldest updates are dropped
+    spy.clear();
+    channel.setQueueLimits(&transport, 1, 0, QWebChannel::DropOldestMessages);
+    obj.setProp("d");
+    publisher->sendPendingPropertyUpdates();
+    publisher->enqueueMessage(QJsonObject{ { "type", TypeSignal } }, &transport);
+    obj.setProp("e");
+    publisher->sendPendingPropertyUpdates();
+    QTRY_COMPARE(spy.size(), 2);
+    QCOMPARE(queue().size(), 1);
+    QCOMPARE(queue().first().message["data"].toArray().first().toObject()["properties"]
+                     .toObject().begin().value().toString(),
+             QStringLiteral("e"));
+
+    // the byte limit applies to the serialized messages
+    spy.clear();
+    channel.setQueueLimits(&transport, 0, 1, QWebChannel::DropOldestMessages);
+    QVERIFY(publisher->transportState[&transport].queuedBytes > 1);
+    obj.setProp("f");
+    publisher->sendPendingPropertyUpdates();
+    QTRY_COMPARE(spy.size(), 1);
+    QVERIFY(queue().isEmpty());
+    QCOMPARE(publisher->transportState[&transport].queuedBytes, 0);
+
+    // a stalled client can also be disconnected, the default limits apply to all transports
+    spy.clear();
+    channel.setQueueLimits(&transport, 0, 0);
+    channel.setQueueLimits(nullptr, 1, 0, QWebChannel::DisconnectTransport);
+    DummyTransport other;
+    channel.connectTo(&other);
+    publisher->initializeClient(&other);
+    queueUpdates({ "g", "h" });
+    QCOMPARE(queue().size(), 4);
+    // the transport is disconnected only once
+    queueUpdates({ "i" });
+    QVERIFY(publisher->transportState[&other].queuedMessages.isEmpty());
+    QTRY_VERIFY(!channel.d_func()->transports.contains(&other));
+    QCOMPARE(spy.size(), 1);
+    QCOMPARE(spy.first().at(0).value<QWebChannelAbstractTransport *>(), &other);
+    QVERIFY(channel.d_func()->transports.contains(&transport));
+    channel.setQueueLimits(nullptr, 0, 0);
+
+    // receivers of the signal may disconnect or delete the transport
+    spy.clear();
+    auto *deleted = new DummyTransport;
+    channel.connectTo(deleted);
+    publisher->initializeClient(deleted);
+    channel.setQueueLimits(deleted, 1, 0, QWebChannel::DropOldestMessages);
+    channel.setQueueLimits(&transport, 1, 0, QWebChannel::DropOldestMessages);
+    const auto connection = connect(&channel, &QWebChannel::queueLimitReached, &channel,
+                                    [&](QWebChannelAbstractTransport *reached) {
+        if (reached == deleted)
+            delete reached;
+        else
+            channel.disconnectFrom(reached);
+    });
+    queueUpdates({ "j", "k", "l" });
+    QTRY_COMPARE(spy.size(), 2);
+    disconnect(connection);
+    QVERIFY(channel.d_func()->transports.isEmpty());
+    QVERIFY(publisher->transportState.isEmpty());
+    // the notifications of further updates are dropped for the removed transports
+    queueUpdates({ "m" });
+    QVERIFY(publisher->transportState.isEmpty());
+}
+
+void TestWebChannel::testPackedArrays()
+{
+    QWebChannel channel;
+    DummyTransport transport;
+    DummyTransport plain;
+    channel.connectTo(&transport);
+    channel.connectTo(&plain);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "packedArrays", true } } },
+        }, &transport);
+    QCOMPARE(transport.messagesSent().first()["capabilities"].toObject(),
+             (QJsonObject{ { "packedArrays", true } }));
+
+    // lists of numbers are sent as little endian buffers
+    const QList<float> floats{ 1.5f, -2.0f, 3.25f };
+    const QJsonObject packed =
+            publisher->wrapResult(QVariant::fromValue(floats), &transport).toObject();
+    QCOMPARE(packed["__packed__"].toString(), QStringLiteral("f32"));
+    const QByteArray bytes = QByteArray::fromBase64(packed["data"].toString().toLatin1());
+    QCOMPARE(bytes.size(), floats.size() * qsizetype(sizeof(float)));
+    for (qsizetype i = 0; i < floats.size(); ++i)
+        QCOMPARE(qFromLittleEndian<float>(bytes.constData() + i * sizeof(float)), floats.at(i));
+
+    QCOMPARE(publisher->wrapResult(QVariant::fromValue(QList<double>{ 1 }), &transport)
+                     .toObject()["__packed__"].toString(),
+             QStringLiteral("f64"));
+    QCOMPARE(publisher->wrapResult(QVariant::fromValue(QList<qint32>{ 1 }), &transport)
+                     .toObject()["__packed__"].toString(),
+             QStringLiteral("i32"));
+
+    // other clients get plain arrays, also when they receive a value along with packing clients
+    const QJsonValue array(QJsonArray{ 1.5, -2, 3.25 });
+    QCOMPARE(publisher->wrapResult(QVariant::fromValue(floats), &plain), array);
+    const qsizetype packingIndex = publisher->transportIndex(&transport);
+    const qsizetype plainIndex = publisher->transportIndex(&plain);
+    QBitArray recipients(qMax(packingIndex, plainIndex) + 1);
+    recipients.setBit(packingIndex);
+    recipients.setBit(plainIndex);
+    QCOMPARE(publisher->wrapResult(QVariant::fromValue(floats), nullptr, QString(), recipients),
+             array);
+}
+
+void TestWebChannel::testWrappedObjectIds()
+{
+    QWebChannel channel;
+    QCOMPARE(channel.wrappedObjectIdFormat(), QWebChannel::SequentialIds);
+    QObject registered;
+    channel.registerObject("{wrapped-0}", &registered);
+    TestObject target;
+    channel.registerObject("target", &target);
+    channel.connectTo(m_dummyTransport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+
+    auto wrappedId = [&](QObject *object) {
+        return publisher->wrapResult(QVariant::fromValue(object), m_dummyTransport)
+                .toObject()["id"].toString();
+    };
+
+    // sequential ids skip the ids of registered objects
+    QObject first;
+    QObject second;
+    QCOMPARE(wrappedId(&first), QStringLiteral("{wrapped-1}"));
+    QCOMPARE(wrappedId(&second), QStringLiteral("{wrapped-2}"));
+    QCOMPARE(wrappedId(&first), QStringLiteral("{wrapped-1}"));
+
+    // a live wrapped id cannot be taken over by a registered object
+    QObject shadow;
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("Cannot register object with id \"\\{wrapped-1\\}\""));
+    channel.registerObject("{wrapped-1}", &shadow);
+    QVERIFY(!channel.registeredObjects().contains("{wrapped-1}"));
+
+    // sequential ids are easily guessed, so other clients cannot address the object
+    TestObject wrapped;
+    const QString id = wrappedId(&wrapped);
+    DummyTransport stranger;
+    channel.connectTo(&stranger);
+    const int propIndex = wrapped.metaObject()->indexOfProperty("prop");
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("Refusing to handle message for object unknown to transport"));
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", id },
+            { "property", propIndex },
+            { "value", "foo" },
+        }, &stranger);
+    QVERIFY(wrapped.prop().isEmpty());
+
+    // while the client it was sent to can
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", id },
+            { "property", propIndex },
+            { "value", "foo" },
+        }, m_dummyTransport);
+    QCOMPARE(wrapped.prop(), QStringLiteral("foo"));
+
+    // nor pass it as an argument or property value, the overload resolution refuses it as well
+    const QJsonObject wrappedArgument{ { "__QObject*__", true }, { "id", id } };
+    const QJsonObject setObjectMessage{
+        { "type", TypeInvokeMethod },
+        { "id", 1 },
+        { "object", "target" },
+        { "method", "setObjectProperty" },
+        { "args", QJsonArray{ wrappedArgument } },
+    };
+    for (int i = 0; i < 2; ++i) {
+        QTest::ignoreMessage(QtWarningMsg,
+                             QRegularExpression("Refusing to unwrap object unknown to transport"));
+    }
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Cannot not convert non-object"));
+    publisher->handleMessage(setObjectMessage, &stranger);
+    QCOMPARE(target.objectProperty(), nullptr);
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("Refusing to unwrap object unknown to transport"));
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Cannot not convert non-object"));
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", "target" },
+            { "property", target.metaObject()->indexOfProperty("objectProperty") },
+            { "value", wrappedArgument },
+        }, &stranger);
+    QCOMPARE(target.objectProperty(), nullptr);
+    publisher->handleMessage(setObjectMessage, m_dummyTransport);
+    QCOMPARE(target.objectProperty(), &wrapped);
+
+    channel.setWrappedObjectIdFormat(QWebChannel::UuidIds);
+    QObject third;
+    QVERIFY(!QUuid::fromString(wrappedId(&third)).isNull());
+}
+
+void TestWebChannel::testObjectHandles()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInit },
+            { "id", 1 },
+            { "capabilities", QJsonObject{ { "handles", true } } },
+        }, &transport);
+    QCOMPARE(transport.messagesSent().size(), 1);
+    const QJsonObject response = transport.messagesSent().first();
+    QCOMPARE(response["capabilities"].toObject(), (QJsonObject{ { "handles", true } }));
+
+    // the client learns the handle along with the object
+    const qint64 handle = publisher->objectHandle(&obj);
+    QVERIFY(handle >= 0);
+    QCOMPARE(response["data"].toObject()["testObject"].toObject()["handle"].toInteger(), handle);
+    QCOMPARE(publisher->objectForHandle(handle), &obj);
+    QCOMPARE(publisher->unwrapObject(QJsonValue(handle)), &obj);
+
+    // and uses it to address the object
+    const int propIndex = obj.metaObject()->indexOfProperty("prop");
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", handle },
+            { "property", propIndex },
+            { "value", "foo" },
+        }, &transport);
+    QCOMPARE(obj.prop(), QStringLiteral("foo"));
+
+    // as does the server
+    publisher->setClientIsIdle(true, &transport);
+    publisher->sendPendingPropertyUpdates();
+    QCOMPARE(transport.messagesSent().size(), 2);
+    const QJsonObject update = transport.messagesSent().last()["data"].toArray().first().toObject();
+    QCOMPARE(update["object"].toInteger(), handle);
+
+    // handles of destroyed objects become invalid, even when their slot is reused
+    auto *wrapped = new TestObject;
+    const QJsonObject wrappedInfo =
+            publisher->wrapResult(QVariant::fromValue(wrapped), &transport).toObject();
+    const qint64 wrappedHandle = wrappedInfo["data"].toObject()["handle"].toInteger(-1);
+    QCOMPARE(publisher->objectForHandle(wrappedHandle), wrapped);
+    delete wrapped;
+    QCOMPARE(publisher->objectForHandle(wrappedHandle), nullptr);
+
+    TestObject reused;
+    publisher->wrapResult(QVariant::fromValue(&reused), &transport);
+    const qint64 reusedHandle = publisher->objectHandle(&reused);
+    QVERIFY(reusedHandle != wrappedHandle);
+    QCOMPARE(reusedHandle & 0xffffff, wrappedHandle & 0xffffff);
+    QCOMPARE(publisher->objectForHandle(wrappedHandle), nullptr);
+    QCOMPARE(publisher->objectForHandle(reusedHandle), &reused);
+
+    // objects can also be passed back by their handle
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeInvokeMethod },
+            { "id", 2 },
+            { "object", handle },
+            { "method", "setObjectProperty" },
+            { "args", QJsonArray{ QJsonObject{ { "__QObject*__", true },
+                                               { "id", reusedHandle } } } },
+        }, &transport);
+    QCOMPARE(obj.objectProperty(), &reused);
+
+    // but other clients cannot address wrapped objects they do not know
+    DummyTransport other;
+    channel.connectTo(&other);
+    publisher->initializeClient(&other);
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("Refusing to handle message for object unknown"));
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", reusedHandle },
+            { "property", propIndex },
+            { "value", "bar" },
+        }, &other);
+    QCOMPARE(reused.prop(), QString());
+    // registered objects are known to all clients
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", handle },
+            { "property", propIndex },
+            { "value", "bar" },
+        }, &other);
+    QCOMPARE(obj.prop(), QStringLiteral("bar"));
+    // nor pass them as arguments or property values
+    QTest::ignoreMessage(QtWarningMsg,
+                         QRegularExpression("Refusing to unwrap object unknown to transport"));
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression("Cannot not convert non-object"));
+    publisher->handleMessage(QJsonObject{
+            { "type", TypeSetProperty },
+            { "object", handle },
+            { "property", obj.metaObject()->indexOfProperty("objectProperty") },
+            { "value", QJsonObject{ { "__QObject*__", true }, { "id", reusedHandle } } },
+        }, &other);
+    QCOMPARE(obj.objectProperty(), nullptr);
+
+    // objects sent to several clients only carry their handle for those that negotiated it
+    TestObject child;
+    obj.setObjectProperty(&child);
+    publisher->setClientIsIdle(true, &transport);
+    publisher->setClientIsIdle(true, &other);
+    publisher->sendPendingPropertyUpdates();
+    const QString objectPropIndex =
+            QString::number(obj.metaObject()->indexOfProperty("objectProperty"));
+    const auto childInfo = [&](DummyTransport &client) {
+        return client.messagesSent().last()["data"].toArray().first()["properties"].toObject()
+                [objectPropIndex].toObject()["data"].toObject();
+    };
+    QCOMPARE(childInfo(transport)["handle"].toInteger(-1), publisher->objectHandle(&child));
+    QVERIFY(!childInfo(other).isEmpty());
+    QVERIFY(!childInfo(other).contains("handle"));
+}
+
+void TestWebChannel::testEncodedBroadcast()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    EncodingTransport transport1;
+    EncodingTransport transport2;
+    channel.connectTo(&transport1);
+    channel.connectTo(&transport2);
+    channel.connectTo(m_dummyTransport);
+
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    publisher->initializeClient(&transport1);
+    publisher->initializeClient(&transport2);
+    publisher->initializeClient(m_dummyTransport);
+    publisher->setClientIsIdle(true, &transport1);
+    publisher->setClientIsIdle(true, &transport2);
+    publisher->setClientIsIdle(true, m_dummyTransport);
+
+    obj.setProp("foo");
+    publisher->sendPendingPropertyUpdates();
+
+    QVERIFY(transport1.messagesSent().isEmpty());
+    QVERIFY(transport2.messagesSent().isEmpty());
+    QCOMPARE(transport1.encodedMessagesSent().size(), 1);
+    QCOMPARE(transport2.encodedMessagesSent().size(), 1);
+    const QByteArray encoded = transport1.encodedMessagesSent().first();
+    // serialized once and shared between both transports
+    QVERIFY(encoded.isSharedWith(transport2.encodedMessagesSent().first()));
+
+    // transports without support for pre-serialized messages still get the JSON object
+    QVERIFY(!m_dummyTransport->messagesSent().isEmpty());
+    QCOMPARE(QJsonDocument::fromJson(encoded).object(), m_dummyTransport->messagesSent().last());
+}
+
+void TestWebChannel::testCborMessages()
+{
+    QWebChannel channel;
+    TestObject obj;
+    channel.registerObject("testObject", &obj);
+
+    EncodingTransport cborTransport(EncodingTransport::JsonFormat | EncodingTransport::CborFormat);
+    EncodingTransport jsonTransport;
+    channel.connectTo(&cborTransport);
+    channel.connectTo(&jsonTransport);
+
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    const QJsonObject initMessage = {
+        { "type", TypeInit },
+        { "id", 1 },
+        { "capabilities", QJsonObject{ { "cbor", true } } },
+    };
+    publisher->handleMessage(initMessage, &cborTransport);
+    publisher->handleMessage(initMessage, &jsonTransport);
+
+    // the init response is always JSON and reports the accepted capabilities
+    QCOMPARE(cborTransport.encodedMessagesSent().size(), 1);
+    QCOMPARE(cborTransport.encodedMessageFormats().first(), EncodingTransport::JsonFormat);
+    QJsonObject response = QJsonDocument::fromJson(cborTransport.encodedMessagesSent().first()).object();
+    QCOMPARE(response["capabilities"].toObject(), (QJsonObject{ { "cbor", true } }));
+    QVERIFY(response["data"].toObject().contains("testObject"));
+
+    QCOMPARE(jsonTransport.encodedMessagesSent().size(), 1);
+    response = QJsonDocument::fromJson(jsonTransport.encodedMessagesSent().first()).object();
+    QCOMPARE(response["capabilities"].toObject(), QJsonObject());
+
+    publisher->handleMessage(QJsonObject{ { "type", TypeIdle } }, &cborTransport);
+    publisher->handleMessage(QJsonObject{ { "type", TypeIdle } }, &jsonTransport);
+    obj.setProp("foo");
+    publisher->sendPendingPropertyUpdates();
+
+    QCOMPARE(cborTransport.encodedMessagesSent().size(), 2);
+    QCOMPARE(cborTransport.encodedMessageFormats().last(), EncodingTransport::CborFormat);
+    QCOMPARE(jsonTransport.encodedMessagesSent().size(), 2);
+    QCOMPARE(jsonTransport.encodedMessageFormats().last(), EncodingTransport::JsonFormat);
+
+    const QJsonObject update =
+            QJsonDocument::fromJson(jsonTransport.encodedMessagesSent().last()).object();
+    QCOMPARE(update["type"].toInt(), int(TypePropertyUpdate));
+    const QJsonValue decoded =
+            QCborValue::fromCbor(cborTransport.encodedMessagesSent().last()).toJsonValue();
+    QCOMPARE(decoded.toObject(), update);
+}
+
+void TestWebChannel::testCborDecoding()
+{
+#ifndef WEBCHANNEL_TESTS_CAN_USE_JS_ENGINE
+    QSKIP("A JS engine is required for this test to make sense.");
+#else
+    const QJsonObject message = {
+        { "type", TypePropertyUpdate },
+        { "integers", QJsonArray{ 0, 23, 24, 255, 256, 65536, -1, -25, -100000, 4294967296. } },
+        { "doubles", QJsonArray{ 0.5, -3.25, 0.1, 1e300, -0.0 } },
+        { "nonFinite", QJsonArray{ std::numeric_limits<double>::infinity(),
+                                   -std::numeric_limits<double>::infinity(),
+                                   std::numeric_limits<double>::quiet_NaN() } },
+        { "literals", QJsonArray{ true, false, QJsonValue() } },
+        { "strings", QJsonArray{ "", "ascii", QString::fromUtf8("\u00e4\u20ac\U0001d11e"),
+                                 QString(1000, u'x') } },
+        { "nested", QJsonObject{ { "x", QJsonArray{ QJsonObject{}, QJsonArray{} } } } },
+    };
+
+    TestJSEngine engine;
+    QJSValue decodeCbor = engine.evaluate("decodeCbor");
+    QVERIFY(decodeCbor.isCallable());
+    const QByteArray cbor = QMetaObjectPublisher::encodeCbor(message);
+    QJSValue decoded = decodeCbor.call({ engine.toScriptValue(cbor) });
+    QVERIFY2(!decoded.isError(), qPrintable(decoded.toString()));
+
+    // the sign of zero does not survive JSON.stringify, compare it separately
+    QVERIFY(engine.evaluate("(function(m) { return Object.is(m.doubles.pop(), -0); })")
+                    .call({ decoded }).toBool());
+    QJsonObject expected = message;
+    QJsonArray doubles = expected["doubles"].toArray();
+    doubles.removeLast();
+    expected["doubles"] = doubles;
+    // non-finite numbers become null, as they do in JSON
+    expected["nonFinite"] = QJsonArray{ QJsonValue(), QJsonValue(), QJsonValue() };
+
+    const QJsonDocument actual = QJsonDocument::fromJson(
+            engine.evaluate("JSON.stringify").call({ decoded }).toString().toUtf8());
+    QCOMPARE(actual.object(), expected);
+#endif // WEBCHANNEL_TESTS_CAN_USE_JS_ENGINE
+}
+
 void TestWebChannel::testWrapRegisteredObject()
 {
     QWebChannel channel;
@@ -938,6 +2118,46 @@ void TestWebChannel::testRemoveUnusedTransports()
     QCOMPARE(pub->registeredObjectIds.size(), 0);
 }
 
+void TestWebChannel::testReuseTransportIndices()
+{
+    QWebChannel channel;
+    DummyTransport *first = new DummyTransport(this);
+    DummyTransport second;
+    TestObject obj;
+
+    channel.connectTo(first);
+    channel.connectTo(&second);
+    QMetaObjectPublisher *pub = channel.d_func()->publisher;
+    pub->initializeClient(first);
+    pub->initializeClient(&second);
+
+    pub->wrapResult(QVariant::fromValue(&obj), first);
+    pub->wrapResult(QVariant::fromValue(&obj), &second);
+    QCOMPARE(pub->wrappedObjects.size(), 1);
+    const QString wrappedObjId = pub->wrappedObjects.keys()[0];
+    QCOMPARE(pub->transportsInSet(pub->wrappedObjects[wrappedObjId].transports).size(), 2);
+
+    // the object stays wrapped while another transport knows it
+    const qsizetype firstIndex = pub->transportIndex(first);
+    channel.disconnectFrom(first);
+    delete first;
+    QCOMPARE(pub->wrappedObjects.size(), 1);
+    QCOMPARE(pub->transportsInSet(pub->wrappedObjects[wrappedObjId].transports),
+             QList<QWebChannelAbstractTransport *>{ &second });
+
+    // a new transport reuses the index, without knowing the objects of the removed one
+    DummyTransport third;
+    channel.connectTo(&third);
+    QCOMPARE(pub->transportIndex(&third), firstIndex);
+    QCOMPARE(pub->transportsInSet(pub->wrappedObjects[wrappedObjId].transports),
+             QList<QWebChannelAbstractTransport *>{ &second });
+
+    QVERIFY(!pub->transportedWrappedObjects.contains(&third));
+
+    channel.disconnectFrom(&second);
+    QCOMPARE(pub->wrappedObjects.size(), 0);
+}
+
 void TestWebChannel::testPassWrappedObjectBack()
 {
     QWebChannel channel;
@@ -983,6 +2203,28 @@ void TestWebChannel::testWrapValues_data()
     QTest::addRow("list") << QVariant::fromValue(QList<int>{1, 2, 3})
                           << QJsonValue(QJsonArray{1, 2, 3});
 
+    QTest::addRow("doubleList") << QVariant::fromValue(QList<double>{1.5, -2, 3})
+                                << QJsonValue(QJsonArray{1.5, -2, 3});
+
+    QTest::addRow("stringList") << QVariant::fromValue(QStringList{"foo", "bar"})
+                                << QJsonValue(QJsonArray{"foo", "bar"});
+
+    // JSON cannot represent NaN and infinity, like QJsonValue::fromVariant they become null
+    QTest::addRow("nonFiniteDoubleList")
+            << QVariant::fromValue(QList<double>{1.5, qQNaN(), qInf(), -qInf()})
+            << QJsonValue(QJsonArray{1.5, QJsonValue(), QJsonValue(), QJsonValue()});
+
+    QTest::addRow("nonFiniteFloatList")
+            << QVariant::fromValue(QList<float>{1.5f, float(qQNaN()), float(qInf())})
+            << QJsonValue(QJsonArray{1.5, QJsonValue(), QJsonValue()});
+
+    QTest::addRow("nonFiniteDoubleMap")
+            << QVariant::fromValue(QMap<QString, double>{{"nan", qQNaN()}, {"inf", -qInf()}})
+            << QJsonValue(QJsonObject{{"nan", QJsonValue()}, {"inf", QJsonValue()}});
+
+    QTest::addRow("intMap") << QVariant::fromValue(QMap<QString, int>{{"One", 1}, {"Two", 2}})
+                            << QJsonValue(QJsonObject{{"One", 1}, {"Two", 2}});
+
     QTest::addRow("customVector") << QVariant::fromValue(TestStructVector{{1, 2}, {3, 4}})
                                   << QJsonValue(QJsonArray({QJsonObject{{"foo", 1}, {"bar", 2}},
                                                             QJsonObject{{"foo", 3}, {"bar", 4}}}));
@@ -1019,6 +2261,33 @@ void TestWebChannel::testWrapValues()
 
     QJsonValue value = channel.d_func()->publisher->wrapResult(variant, m_dummyTransport);
     QCOMPARE(value, json);
+
+    // the classification of the type is reused when wrapping further values
+    QVERIFY(channel.d_func()->publisher->typeClassifications.contains(variant.userType()));
+    value = channel.d_func()->publisher->wrapResult(variant, m_dummyTransport);
+    QCOMPARE(value, json);
+}
+
+void TestWebChannel::testWrapPlainContainers()
+{
+    QWebChannel channel;
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    qRegisterMetaType<QList<int>>();
+    qRegisterMetaType<QMap<QString, double>>();
+    qRegisterMetaType<QMap<int, double>>();
+    qRegisterMetaType<QList<QObject *>>();
+
+    // containers of plain elements are converted without going through QVariantList/QVariantMap
+    auto isDirect = [&](QMetaType type) {
+        return publisher->classifyType(type).elementToJson != nullptr;
+    };
+    QVERIFY(isDirect(QMetaType::fromType<QList<int>>()));
+    QVERIFY(isDirect(QMetaType::fromType<QStringList>()));
+    QVERIFY(isDirect(QMetaType::fromType<QMap<QString, double>>()));
+    QVERIFY(!isDirect(QMetaType::fromType<QMap<int, double>>()));
+    QVERIFY(!isDirect(QMetaType::fromType<QVariantList>()));
+    QVERIFY(!isDirect(QMetaType::fromType<QList<QObject *>>()));
+    QVERIFY(!isDirect(QMetaType::fromType<TestStructVector>()));
 }
 
 void TestWebChannel::testWrapObjectWithMultipleTransports()
@@ -1053,6 +2322,20 @@ void TestWebChannel::testJsonToVariant_data()
                                                           {"foo", 42},
                                                           {"bar", 7}})
                                 << QVariant::fromValue(TestStruct{42, 7});
+
+    QTest::addRow("int") << QJsonValue(42) << QVariant(42);
+    QTest::addRow("intFromString") << QJsonValue("42") << QVariant(42);
+    // numbers out of range are converted as QVariant does
+    QTest::addRow("intOutOfRange") << QJsonValue(qint64(1) << 40)
+                                   << QVariant(QVariant(qlonglong(1) << 40).toInt());
+    QTest::addRow("intFromLargeDouble") << QJsonValue(3e10 + 0.5)
+                                        << QVariant(QVariant(3e10 + 0.5).toInt());
+    QTest::addRow("longlong") << QJsonValue(qint64(1) << 40) << QVariant(qlonglong(1) << 40);
+    QTest::addRow("float") << QJsonValue(0.5) << QVariant(0.5f);
+    QTest::addRow("double") << QJsonValue(4.2) << QVariant(4.2);
+    QTest::addRow("bool") << QJsonValue(true) << QVariant(true);
+    QTest::addRow("string") << QJsonValue("foo") << QVariant(QStringLiteral("foo"));
+    QTest::addRow("stringFromNumber") << QJsonValue(42) << QVariant(QStringLiteral("42"));
 }
 
 void TestWebChannel::testJsonToVariant()
@@ -1065,6 +2348,10 @@ void TestWebChannel::testJsonToVariant()
 
     QVariant convertedValue = channel.d_func()->publisher->toVariant(json, targetVariant.userType());
     QCOMPARE(convertedValue, targetVariant);
+
+    // the specialized conversions give the same result
+    convertedValue = channel.d_func()->publisher->toArgument(json, targetVariant.metaType());
+    QCOMPARE(convertedValue, targetVariant);
 }
 
 void TestWebChannel::testInfiniteRecursion()
@@ -1080,7 +2367,12 @@ void TestWebChannel::testInfiniteRecursion()
     QJsonObject objectInfo = channel.d_func()->publisher->wrapResult(QVariant::fromValue(&obj), m_dummyTransport).toObject();
 
     // Wrap the result twice to test for QTBUG-84007. A single result wrap will not trigger all recursion paths.
-    objectInfo = channel.d_func()->publisher->wrapResult(QVariant::fromValue(&obj), m_dummyTransport).toObject();
+    // The second transport does not know the object yet, so its class information is sent again.
+    DummyTransport transport;
+    channel.connectTo(&transport);
+    channel.d_func()->publisher->initializeClient(&transport);
+    objectInfo = channel.d_func()->publisher->wrapResult(QVariant::fromValue(&obj), &transport).toObject();
+    QVERIFY(objectInfo.contains("data"));
 }
 
 void TestWebChannel::testAsyncObject()
@@ -1564,13 +2856,16 @@ void TestWebChannel::qtbug62388_wrapObjectMultipleTransports()
 
     obj.setProp("asdf");
 
-    const auto objectInfo2 = queryObjectInfo(&obj, m_dummyTransport);
-    QVERIFY(objectInfo2 != objectInfo);
-    verifyObjectInfo(objectInfo2);
+    // transports which already received the class information get a plain reference
+    const QJsonObject reference{ { "__QObject*__", true }, { "id", id } };
+    QCOMPARE(queryObjectInfo(&obj, m_dummyTransport), reference);
+    QCOMPARE(queryObjectInfo(&obj, &transport), reference);
 
     DummyTransport transport2;
     initTransport(&transport2);
-    QCOMPARE(queryObjectInfo(&obj, &transport2), objectInfo2);
+    const auto objectInfo2 = queryObjectInfo(&obj, &transport2);
+    QVERIFY(objectInfo2 != objectInfo);
+    verifyObjectInfo(objectInfo2);
 
     // don't crash when the transports are destroyed
 }
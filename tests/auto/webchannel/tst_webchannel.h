@@ -73,6 +73,41 @@ private:
     QList<QJsonObject> mMessagesSent;
 };
 
+class EncodingTransport : public QWebChannelAbstractTransport
+{
+    Q_OBJECT
+public:
+    explicit EncodingTransport(MessageFormats formats = JsonFormat, QObject *parent = nullptr)
+        : QWebChannelAbstractTransport(parent)
+        , mFormats(formats)
+    {
+        setSupportedMessageFormats(formats);
+    }
+
+    QList<QJsonObject> messagesSent() const { return mMessagesSent; }
+    QList<QByteArray> encodedMessagesSent() const { return mEncodedMessagesSent; }
+    QList<MessageFormat> encodedMessageFormats() const { return mEncodedMessageFormats; }
+
+public slots:
+    void sendMessage(const QJsonObject &message) override
+    {
+        mMessagesSent.push_back(message);
+    }
+
+    void sendEncodedMessage(const QByteArray &message,
+                            QWebChannelAbstractTransport::MessageFormat format)
+    {
+        Q_ASSERT(mFormats.testFlag(format));
+        mEncodedMessagesSent.push_back(message);
+        mEncodedMessageFormats.push_back(format);
+    }
+private:
+    MessageFormats mFormats;
+    QList<QJsonObject> mMessagesSent;
+    QList<QByteArray> mEncodedMessagesSent;
+    QList<MessageFormat> mEncodedMessageFormats;
+};
+
 class TestObject : public QObject
 {
     Q_OBJECT
@@ -157,6 +192,8 @@ signals:
     void replay();
     void overloadSignal(int);
     void overloadSignal(float);
+    void argumentsSignal(int, double, bool, const QString &, const QByteArray &,
+                         const QStringList &, const QVariant &);
 
 public slots:
     void slot1() {}
@@ -258,18 +295,40 @@ private slots:
     void testDeregisterObjects();
     void testDeregisterObjectAtStart();
     void testInfoForObject();
+    void testInfoForObjectCache();
+    void testTypeDescriptors();
+    void testLazyInit();
     void testInvokeMethodConversion();
     void testFunctionOverloading();
     void testSetPropertyConversion();
     void testInvokeMethodOverloadResolution();
+    void testInvokeMethodDynamicMetaObject();
     void testDisconnect();
+    void testSignalSubscriptions();
+    void testSignalArguments();
+    void testPendingPropertyUpdates();
+    void testPropertyUpdateWiring();
+    void testClassInfoSentOnce();
+    void testClassInfoOfQueuedUpdates();
+    void testPropertyInterest();
+    void testCreditFlowControl();
+    void testCoalescedUpdates();
+    void testQueueLimits();
+    void testObjectHandles();
+    void testWrappedObjectIds();
+    void testPackedArrays();
+    void testEncodedBroadcast();
+    void testCborMessages();
+    void testCborDecoding();
     void testWrapRegisteredObject();
     void testUnwrapObject();
     void testTransportWrapObjectProperties();
     void testRemoveUnusedTransports();
+    void testReuseTransportIndices();
     void testPassWrappedObjectBack();
     void testWrapValues_data();
     void testWrapValues();
+    void testWrapPlainContainers();
     void testWrapObjectWithMultipleTransports();
     void testJsonToVariant_data();
     void testJsonToVariant();
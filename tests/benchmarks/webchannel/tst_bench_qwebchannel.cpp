@@ -24,6 +24,14 @@ private slots:
     void benchPropertyUpdates();
     void benchRegisterObjects();
     void benchRemoveTransport();
+    void benchSignalDispatch();
+    void benchWrapObjectList_data();
+    void benchWrapObjectList();
+    void benchWrapNumericList();
+    void benchToVariant_data();
+    void benchToVariant();
+    void benchToArgument_data();
+    void benchToArgument();
 
 private:
     DummyTransport *m_dummyTransport;
@@ -145,6 +153,118 @@ void tst_bench_QWebChannel::benchRemoveTransport()
     }
 }
 
+void tst_bench_QWebChannel::benchSignalDispatch()
+{
+    QWebChannel channel;
+    channel.connectTo(m_dummyTransport);
+
+    BenchObject object;
+    channel.registerObject(QStringLiteral("object"), &object);
+    channel.d_func()->publisher->initializeClient(m_dummyTransport);
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i)
+            emit object.p0Changed(i);
+    }
+}
+
+void tst_bench_QWebChannel::benchWrapObjectList_data()
+{
+    QTest::addColumn<QWebChannel::WrappedObjectIdFormat>("idFormat");
+
+    QTest::newRow("sequential") << QWebChannel::SequentialIds;
+    QTest::newRow("uuid") << QWebChannel::UuidIds;
+}
+
+void tst_bench_QWebChannel::benchWrapObjectList()
+{
+    QFETCH(QWebChannel::WrappedObjectIdFormat, idFormat);
+
+    QWebChannel channel;
+    channel.setWrappedObjectIdFormat(idFormat);
+    channel.connectTo(m_dummyTransport);
+    QMetaObjectPublisher *pub = channel.d_func()->publisher;
+    pub->initializeClient(m_dummyTransport);
+
+    // a method returning many fresh objects, all of them are wrapped for the first time
+    std::vector<std::unique_ptr<QObject>> objs;
+    QVariantList list;
+    for (int i = 0; i < 10000; ++i) {
+        objs.push_back(std::make_unique<QObject>());
+        list.append(QVariant::fromValue(objs.back().get()));
+    }
+
+    QBENCHMARK_ONCE {
+        pub->wrapResult(list, m_dummyTransport);
+    }
+}
+
+void tst_bench_QWebChannel::benchWrapNumericList()
+{
+    QWebChannel channel;
+    channel.connectTo(m_dummyTransport);
+    QMetaObjectPublisher *pub = channel.d_func()->publisher;
+
+    QList<double> series;
+    series.reserve(100000);
+    for (int i = 0; i < 100000; ++i)
+        series.append(i * 0.5);
+    const QVariant result = QVariant::fromValue(series);
+
+    QBENCHMARK {
+        pub->wrapResult(result, m_dummyTransport);
+    }
+}
+
+static void argumentConversionData()
+{
+    QTest::addColumn<QJsonValue>("value");
+    QTest::addColumn<int>("type");
+
+    QTest::newRow("int") << QJsonValue(42) << int(QMetaType::Int);
+    QTest::newRow("longlong") << QJsonValue(42) << int(QMetaType::LongLong);
+    QTest::newRow("double") << QJsonValue(4.2) << int(QMetaType::Double);
+    QTest::newRow("bool") << QJsonValue(true) << int(QMetaType::Bool);
+    QTest::newRow("string") << QJsonValue(QStringLiteral("foo")) << int(QMetaType::QString);
+    QTest::newRow("stringlist") << QJsonValue(QJsonArray{ "foo", "bar" })
+                                << int(QMetaType::QStringList);
+}
+
+void tst_bench_QWebChannel::benchToVariant_data()
+{
+    argumentConversionData();
+}
+
+void tst_bench_QWebChannel::benchToVariant()
+{
+    QFETCH(QJsonValue, value);
+    QFETCH(int, type);
+
+    QWebChannel channel;
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    QBENCHMARK {
+        publisher->toVariant(value, type);
+    }
+}
+
+void tst_bench_QWebChannel::benchToArgument_data()
+{
+    argumentConversionData();
+}
+
+void tst_bench_QWebChannel::benchToArgument()
+{
+    QFETCH(QJsonValue, value);
+    QFETCH(int, type);
+
+    QWebChannel channel;
+    QMetaObjectPublisher *publisher = channel.d_func()->publisher;
+    const QMetaType metaType(type);
+    QBENCHMARK {
+        publisher->toArgument(value, metaType);
+    }
+}
+
 QTEST_MAIN(tst_bench_QWebChannel)
 
 #include "tst_bench_qwebchannel.moc"